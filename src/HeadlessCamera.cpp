@@ -0,0 +1,13 @@
+#include "camera.h"
+
+// ====================================================================
+// ====================================================================
+// Without a window there are no view & projection matrices to set up
+// (ray tracing only uses the camera parameters themselves)
+
+void OrthographicCamera::glPlaceCamera() {}
+
+void PerspectiveCamera::glPlaceCamera() {}
+
+// ====================================================================
+// ====================================================================
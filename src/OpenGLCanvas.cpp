@@ -1,5 +1,4 @@
 #include <vector>
-#include <filesystem>
 #include <thread>
 
 #include "OpenGLCanvas.h"
@@ -198,7 +197,7 @@ void OpenGLCanvas::keyboardCB(GLFWwindow* w, int key, int /*scancode*/, int acti
         switch (key) {
         case GLFW_KEY_R: case GLFW_KEY_ENTER: case GLFW_KEY_KP_ENTER: {
           std::thread renderT{[] {
-            args->raytracer->renderToFile(std::filesystem::current_path()/std::filesystem::path{args->input_file}.replace_extension("ppm"));
+            args->raytracer->renderToFile(args->output_file);
           }};
           renderT.join();
           break;
@@ -3,6 +3,8 @@
 // ================================================================
 
 #include <iostream>
+#include <random>
+#include <filesystem>
 
 #include "mesh.h"
 #include "raytracer.h"
@@ -13,12 +15,6 @@
 #include "meshdata.h"
 #include "camera.h"
 
-#if __APPLE__
-#include "matrix.h"
-#else
-#include <glm/gtc/type_ptr.hpp>
-#endif
-
 
 ArgParser *GLOBAL_args;
 
@@ -28,8 +24,16 @@ void ArgParser::DefaultValues() {
   // BASIC RENDERING PARAMETERS
   input_file = "";
   path = "";
+  output_file = "";
+#if HEADLESS
+  // this build has no window to open
+  headless = true;
+#else
+  headless = false;
+#endif
   mesh_data->width = 500;
   mesh_data->height = 500;
+  mesh_data->num_threads = 0;
   mesh_data->raytracing_divs_x = 1;
   mesh_data->raytracing_divs_y = 1;
   mesh_data->raytracing_x = 0;
@@ -41,7 +45,13 @@ void ArgParser::DefaultValues() {
   mesh_data->render_mode = RENDER_MATERIALS;
   mesh_data->interpolate = false;
   mesh_data->wireframe = false;
+  mesh_data->radiosity_solver = RADIOSITY_SHOOTING;
+  mesh_data->form_factor_method = FORM_FACTORS_RAYCAST;
   mesh_data->num_form_factor_samples = 1;
+  mesh_data->hemicube_resolution = 128;
+  mesh_data->sparse_form_factors = false;
+  mesh_data->hierarchical_radiosity = false;
+  mesh_data->hierarchical_epsilon = 0.001;
   mesh_data->sphere_horiz = 8;
   mesh_data->sphere_vert = 6;
   mesh_data->cylinder_ring_rasterization = 20;
@@ -53,6 +63,19 @@ void ArgParser::DefaultValues() {
   mesh_data->num_glossy_samples = 1;
   mesh_data->ambient_light = {0.f,0.f,0.f};
   mesh_data->intersect_backfacing = false;
+  mesh_data->sample_all_lights = false;
+  mesh_data->russian_roulette = false;
+  mesh_data->russian_roulette_depth = 3;
+  mesh_data->irradiance_cache = false;
+  mesh_data->irradiance_cache_error = 0.2;
+  mesh_data->irradiance_cache_samples = 256;
+  mesh_data->irradiance_cache_prepass = 0;
+#ifndef DETERMINISTIC_RAND
+  // random seed
+  Sampler::SetSeed(std::random_device{}());
+#else
+  Sampler::SetSeed(37);
+#endif
 
   // PHOTON MAPPING PARAMETERS
   mesh_data->render_photons = true;
@@ -60,7 +83,15 @@ void ArgParser::DefaultValues() {
   mesh_data->render_kdtree = false;
   mesh_data->num_photons_to_shoot = 10000;
   mesh_data->num_photons_to_collect = 100;
+  mesh_data->num_caustic_photons_to_shoot = 0;
+  mesh_data->num_caustic_photons_to_collect = 50;
+  mesh_data->photon_map = PHOTON_MAP_KDTREE;
+  mesh_data->photon_gather_radius = 0;
+  mesh_data->progressive_photon_passes = 0;
+  mesh_data->progressive_alpha = 0.7;
   mesh_data->gather_indirect = false;
+  mesh_data->final_gather_samples = 0;
+  mesh_data->precompute_irradiance = 4;
 
   // RENDERING GEOMETRY
   mesh_data->meshTriCount = 0;
@@ -88,14 +119,60 @@ ArgParser::ArgParser(int argc, const char *argv[], MeshData *_mesh_data):
     if (argv[i] == std::string{"--input"}) {
       i++; assert (i < argc);
       separatePathAndFile(argv[i],path,input_file);
+    } else if (argv[i] == std::string{"--output"}) {
+      i++; assert (i < argc);
+      output_file = argv[i];
+    } else if (argv[i] == std::string{"--headless"}) {
+      headless = true;
     } else if (argv[i] == std::string{"--size"}) {
       i++; assert (i < argc);
       mesh_data->width = atoi(argv[i]);
       i++; assert (i < argc);
       mesh_data->height = atoi(argv[i]);
+    } else if (argv[i] == std::string{"--threads"}) {
+      i++; assert (i < argc);
+      mesh_data->num_threads = atoi(argv[i]);
+      assert (mesh_data->num_threads >= 0);
     } else if (argv[i] == std::string{"--num_form_factor_samples"}) {
       i++; assert (i < argc);
       mesh_data->num_form_factor_samples = atoi(argv[i]);
+    } else if (argv[i] == std::string{"--radiosity_solver"}) {
+      i++; assert (i < argc);
+      if (argv[i] == std::string{"shooting"}) {
+        mesh_data->radiosity_solver = RADIOSITY_SHOOTING;
+      } else if (argv[i] == std::string{"jacobi"}) {
+        mesh_data->radiosity_solver = RADIOSITY_JACOBI;
+      } else if (argv[i] == std::string{"gauss_seidel"}) {
+        mesh_data->radiosity_solver = RADIOSITY_GAUSS_SEIDEL;
+      } else {
+        std::cerr << "ERROR: unknown radiosity solver '" << argv[i] << "'" << std::endl;
+        exit(1);
+      }
+    } else if (argv[i] == std::string{"--form_factors"}) {
+      i++; assert (i < argc);
+      if (argv[i] == std::string{"raycast"}) {
+        mesh_data->form_factor_method = FORM_FACTORS_RAYCAST;
+      } else if (argv[i] == std::string{"hemicube"}) {
+        mesh_data->form_factor_method = FORM_FACTORS_HEMICUBE;
+      } else {
+        std::cerr << "ERROR: unknown form factor method '" << argv[i] << "'" << std::endl;
+        exit(1);
+      }
+    } else if (argv[i] == std::string{"--hemicube_resolution"}) {
+      i++; assert (i < argc);
+      mesh_data->hemicube_resolution = atoi(argv[i]);
+      assert (mesh_data->hemicube_resolution > 0);
+    } else if (argv[i] == std::string{"--form_factor_cache"}) {
+      i++; assert (i < argc);
+      form_factor_cache = argv[i];
+    } else if (argv[i] == std::string{"--sparse_form_factors"}) {
+      mesh_data->sparse_form_factors = true;
+    } else if (argv[i] == std::string{"--hierarchical_radiosity"}) {
+      mesh_data->hierarchical_radiosity = true;
+    } else if (argv[i] == std::string{"--hierarchical_epsilon"}) {
+      i++; assert (i < argc);
+      mesh_data->hierarchical_epsilon = atof(argv[i]);
+      mesh_data->hierarchical_radiosity = true;
     } else if (argv[i] == std::string{"--sphere_rasterization"}) {
       i++; assert (i < argc);
       mesh_data->sphere_horiz = atoi(argv[i]);
@@ -119,6 +196,34 @@ ArgParser::ArgParser(int argc, const char *argv[], MeshData *_mesh_data):
       i++; assert (i < argc);
       mesh_data->num_glossy_samples = atoi(argv[i]);
       assert (mesh_data->num_glossy_samples > 0);
+    } else if (argv[i] == std::string{"--russian_roulette"}) {
+      mesh_data->russian_roulette = true;
+    } else if (argv[i] == std::string{"--russian_roulette_depth"}) {
+      i++; assert (i < argc);
+      mesh_data->russian_roulette_depth = atoi(argv[i]);
+      assert (mesh_data->russian_roulette_depth >= 0);
+    } else if (argv[i] == std::string{"--irradiance_cache"}) {
+      mesh_data->irradiance_cache = true;
+    } else if (argv[i] == std::string{"--irradiance_cache_error"}) {
+      i++; assert (i < argc);
+      mesh_data->irradiance_cache_error = atof(argv[i]);
+      assert (mesh_data->irradiance_cache_error > 0);
+      mesh_data->irradiance_cache = true;
+    } else if (argv[i] == std::string{"--irradiance_cache_samples"}) {
+      i++; assert (i < argc);
+      mesh_data->irradiance_cache_samples = atoi(argv[i]);
+      assert (mesh_data->irradiance_cache_samples > 0);
+      mesh_data->irradiance_cache = true;
+    } else if (argv[i] == std::string{"--irradiance_cache_prepass"}) {
+      i++; assert (i < argc);
+      mesh_data->irradiance_cache_prepass = atoi(argv[i]);
+      assert (mesh_data->irradiance_cache_prepass >= 0);
+      mesh_data->irradiance_cache = true;
+    } else if (argv[i] == std::string{"--sample_all_lights"}) {
+      mesh_data->sample_all_lights = true;
+    } else if (argv[i] == std::string{"--seed"}) {
+      i++; assert (i < argc);
+      Sampler::SetSeed(strtoull(argv[i],nullptr,10));
     } else if (argv[i] == std::string{"--ambient_light"}) {
       i++; assert (i < argc);
       float r = atof(argv[i]);
@@ -133,8 +238,45 @@ ArgParser::ArgParser(int argc, const char *argv[], MeshData *_mesh_data):
     } else if (argv[i] == std::string{"--num_photons_to_collect"}) {
       i++; assert (i < argc);
       mesh_data->num_photons_to_collect = atoi(argv[i]);
+    } else if (argv[i] == std::string{"--num_caustic_photons_to_shoot"}) {
+      i++; assert (i < argc);
+      mesh_data->num_caustic_photons_to_shoot = atoi(argv[i]);
+    } else if (argv[i] == std::string{"--num_caustic_photons_to_collect"}) {
+      i++; assert (i < argc);
+      mesh_data->num_caustic_photons_to_collect = atoi(argv[i]);
+    } else if (argv[i] == std::string{"--photon_map"}) {
+      i++; assert (i < argc);
+      if (argv[i] == std::string{"kdtree"}) {
+        mesh_data->photon_map = PHOTON_MAP_KDTREE;
+      } else if (argv[i] == std::string{"hash_grid"}) {
+        mesh_data->photon_map = PHOTON_MAP_HASH_GRID;
+      } else {
+        std::cerr << "ERROR: unknown photon map '" << argv[i] << "'" << std::endl;
+        exit(1);
+      }
+    } else if (argv[i] == std::string{"--photon_gather_radius"}) {
+      i++; assert (i < argc);
+      mesh_data->photon_gather_radius = atof(argv[i]);
+      assert (mesh_data->photon_gather_radius >= 0);
+    } else if (argv[i] == std::string{"--progressive_photon_passes"}) {
+      i++; assert (i < argc);
+      mesh_data->progressive_photon_passes = atoi(argv[i]);
+      mesh_data->gather_indirect = true;
+    } else if (argv[i] == std::string{"--progressive_alpha"}) {
+      i++; assert (i < argc);
+      mesh_data->progressive_alpha = atof(argv[i]);
+      assert (mesh_data->progressive_alpha > 0 && mesh_data->progressive_alpha <= 1);
     } else if (argv[i] == std::string{"--gather_indirect"}) {
       mesh_data->gather_indirect = true;
+    } else if (argv[i] == std::string{"--final_gather_samples"}) {
+      i++; assert (i < argc);
+      mesh_data->final_gather_samples = atoi(argv[i]);
+      assert (mesh_data->final_gather_samples >= 0);
+      mesh_data->gather_indirect = true;
+    } else if (argv[i] == std::string{"--precompute_irradiance"}) {
+      i++; assert (i < argc);
+      mesh_data->precompute_irradiance = atoi(argv[i]);
+      assert (mesh_data->precompute_irradiance >= 0);
     } else {
       std::cerr << "ERROR: unknown command line argument "
                 << i << ": '" << argv[i] << "'" << std::endl;
@@ -142,6 +284,10 @@ ArgParser::ArgParser(int argc, const char *argv[], MeshData *_mesh_data):
     }
   }
 
+  // by default, save renders next to where we were launched, named after the input
+  if (output_file.empty())
+    output_file = (std::filesystem::current_path()/std::filesystem::path{input_file}.replace_extension("ppm")).string();
+
   raytracer = nullptr;
   radiosity = nullptr;
   photon_mapping = nullptr;
@@ -149,7 +295,9 @@ ArgParser::ArgParser(int argc, const char *argv[], MeshData *_mesh_data):
 
   Load();
   GLOBAL_args = this;
-  packMesh(mesh_data,raytracer,radiosity,photon_mapping);
+  // (the geometry for the window isn't needed without one)
+  if (!headless)
+    packMesh(mesh_data,raytracer,radiosity,photon_mapping);
 }
 
 // ================================================================
@@ -6,7 +6,7 @@
 #define __ARG_PARSER_H__
 
 #include <string>
-#include <random>
+#include "sampler.h"
 
 struct MeshData;
 class Mesh;
@@ -26,16 +26,9 @@ public:
 
   ArgParser(int argc, const char *argv[], MeshData *_mesh_data);
 
+  // random real in [0,1), drawn from the calling thread's sampler
   static double rand() {
-#ifndef DETERMINISTIC_RAND
-    // random seed
-    static std::random_device rd;    
-    static std::mt19937 engine(rd());
-#else
-    static std::mt19937 engine(37);
-#endif
-    static std::uniform_real_distribution<double> dist(0.0, 1.0);
-    return dist(engine);
+    return Sampler::Current().Get1D();
   }
 
   // helper functions
@@ -50,6 +43,12 @@ public:
 
   std::string input_file;
   std::string path;
+  // where renderToFile saves the image
+  std::string output_file;
+  // render to output_file and quit, without ever opening a window
+  bool headless;
+  // where the radiosity form factors are saved and reused (none if empty)
+  std::string form_factor_cache;
 
   Mesh *mesh;
   MeshData *mesh_data;
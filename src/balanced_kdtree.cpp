@@ -0,0 +1,130 @@
+#include <algorithm>
+#include <numeric>
+
+#include "balanced_kdtree.h"
+#include "boundingbox.h"
+#include "parallel.h"
+
+// ==================================================================
+// CONSTRUCTION
+
+namespace {
+
+// the number of nodes in the left subtree of a left balanced tree of n
+std::size_t LeftSize(std::size_t n) {
+  if (n <= 1) return 0;
+  // the levels above the last are full, m - 1 nodes in all
+  std::size_t m{1};
+  while (2 * m <= n) m *= 2;
+  const std::size_t last{n - (m - 1)};
+  return (m / 2 - 1) + std::min(last, m / 2);
+}
+
+// the photons order[begin, end) in the subtree at node
+struct Subtree {
+  std::size_t begin, end, node;
+};
+
+// puts the root of the subtree in the tree, with the photons of its
+// left and right subtrees on either side of it in order, and returns
+// where it was
+std::size_t Split(std::vector<PackedPhoton> &unsorted, std::vector<std::size_t> &order, const Subtree &s,
+                  std::vector<std::size_t> &tree) {
+  // split along the longest axis of these photons
+  BoundingBox bbox{unsorted[order[s.begin]].getPosition()};
+  for (std::size_t i{s.begin + 1}; i < s.end; ++i)
+    bbox.Extend(unsorted[order[i]].getPosition());
+  const Vec3f extent{bbox.getMax() - bbox.getMin()};
+  int axis{0};
+  if (extent.y() > extent[axis]) axis = 1;
+  if (extent.z() > extent[axis]) axis = 2;
+
+  // at whichever photon leaves the left subtree its size
+  const std::size_t median{s.begin + LeftSize(s.end - s.begin)};
+  std::nth_element(order.begin() + s.begin, order.begin() + median, order.begin() + s.end,
+    [&] (std::size_t a, std::size_t b) {
+      return unsorted[a].getPosition(axis) < unsorted[b].getPosition(axis);
+    });
+  tree[s.node] = order[median];
+  unsorted[order[median]].setSplitAxis(axis);
+  return median;
+}
+
+void Build(std::vector<PackedPhoton> &unsorted, std::vector<std::size_t> &order, const Subtree &s,
+           std::vector<std::size_t> &tree) {
+  if (s.begin == s.end) return;
+  const std::size_t median{Split(unsorted, order, s, tree)};
+  Build(unsorted, order, {s.begin, median, 2 * s.node + 1}, tree);
+  Build(unsorted, order, {median + 1, s.end, 2 * s.node + 2}, tree);
+}
+
+}
+
+BalancedKDTree::BalancedKDTree(std::vector<PackedPhoton> unsorted) {
+  const std::size_t n{unsorted.size()};
+  photons.resize(n);
+  std::vector<std::size_t> order(n), tree(n);
+  std::iota(order.begin(), order.end(), 0);
+
+  // The subtrees are independent once their photons are split from
+  // the rest.  So the top levels are split a level at a time, with the
+  // nodes of each level in parallel, until there are enough subtrees
+  // to keep every worker busy, and then those are built in parallel.
+  std::vector<Subtree> level;
+  if (n > 0) level.push_back({0, n, 0});
+  const std::size_t enough{4 * static_cast<std::size_t>(NumWorkerThreads())};
+  while (!level.empty() && level.size() < enough) {
+    std::vector<Subtree> next(2 * level.size());
+    ParallelFor(level.size(), [&] (int i, int) {
+      const Subtree &s{level[i]};
+      const std::size_t median{Split(unsorted, order, s, tree)};
+      next[2 * i] = {s.begin, median, 2 * s.node + 1};
+      next[2 * i + 1] = {median + 1, s.end, 2 * s.node + 2};
+    });
+    next.erase(std::remove_if(next.begin(), next.end(), [] (const Subtree &s) { return s.begin == s.end; }),
+               next.end());
+    level.swap(next);
+  }
+  ParallelFor(level.size(), [&] (int i, int) {
+    Build(unsorted, order, level[i], tree);
+  });
+
+  // and then the photons are moved into tree order
+  constexpr std::size_t CHUNK{1 << 14};
+  ParallelFor((n + CHUNK - 1) / CHUNK, [&] (int c, int) {
+    for (std::size_t i{c * CHUNK}; i < std::min(n, (c + 1) * CHUNK); ++i)
+      photons[i] = unsorted[tree[i]];
+  });
+}
+
+// ==================================================================
+// QUERIES
+
+float BalancedKDTree::CollectNearest(const Vec3f &point, int k, float max_distance_sqr,
+                                     std::vector<Neighbor> &nearest) const {
+  nearest.clear();
+  if (photons.empty() || k <= 0) return 0;
+  locate(0, point, k, max_distance_sqr, nearest);
+  return nearest.empty()? 0 : nearest.front().distance_sqr;
+}
+
+void BalancedKDTree::locate(std::size_t node, const Vec3f &point, std::size_t k, float &max_distance_sqr,
+                            std::vector<Neighbor> &nearest) const {
+  const PackedPhoton &p{photons[node]};
+
+  // the side of the split the point is on first, and then the other,
+  // if it's close enough to the split to hold anything nearer
+  if (const std::size_t left{2 * node + 1}; left < photons.size()) {
+    const int axis{p.getSplitAxis()};
+    const float delta{point[axis] - p.getPosition(axis)};
+    const std::size_t near{delta < 0? left : left + 1}, far{delta < 0? left + 1 : left};
+    if (near < photons.size())
+      locate(near, point, k, max_distance_sqr, nearest);
+    if (delta * delta < max_distance_sqr && far < photons.size())
+      locate(far, point, k, max_distance_sqr, nearest);
+  }
+
+  Offer(p, DistanceSqr(p, point), k, max_distance_sqr, nearest);
+}
+
+// ==================================================================
@@ -0,0 +1,42 @@
+#ifndef _BALANCED_KDTREE_H_
+#define _BALANCED_KDTREE_H_
+
+#include <vector>
+#include "photon_map.h"
+
+// ==================================================================
+// A kd-tree of photons for the k nearest neighbor queries of photon
+// map density estimation (Jensen, "Realistic Image Synthesis Using
+// Photon Mapping").  It is built once, after all of the photons are
+// traced, by splitting at the median along the longest axis, and kept
+// left balanced:  every level is full except the last, which is
+// filled from the left.  So, like a binary heap, it needs no pointers
+// or boxes.  The photon at node i is the split, and its children are
+// at 2i+1 and 2i+2.  The photons are packed (see PackedPhoton), with
+// the split axis in the spare byte.
+
+class BalancedKDTree : public PhotonMap {
+
+public:
+
+  // ===========
+  // CONSTRUCTOR
+  // (in any order; built on the worker threads)
+  explicit BalancedKDTree(std::vector<PackedPhoton> photons);
+
+  // =========
+  // ACCESSORS
+  // (the photons are in tree order)
+  float CollectNearest(const Vec3f &point, int k, float max_distance_sqr,
+                       std::vector<Neighbor> &nearest) const override;
+
+private:
+
+  // HELPER FUNCTION
+  void locate(std::size_t node, const Vec3f &point, std::size_t k, float &max_distance_sqr,
+              std::vector<Neighbor> &nearest) const;
+};
+
+// ==================================================================
+
+#endif
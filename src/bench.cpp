@@ -0,0 +1,210 @@
+// ================================================================
+// Ray throughput benchmark.  Renders each of the bundled scenes with
+// a fixed seed over a sweep of the ray tracing parameters, and prints
+// the ray counts, rays per second, and the time spent in each phase
+// as JSON on stdout (everything else the renderer prints goes to
+// stderr), so the results of different builds can be compared.
+//
+//   bench [--scenes dir] [--scene name]... [--size w h] [--threads n]
+//         [--seed s] [--num_bounces 0,1,2] [--num_shadow_samples 1,4]
+//         [--num_antialias_samples 1,4]
+// ================================================================
+
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "argparser.h"
+#include "bvh.h"
+#include "image.h"
+#include "mesh.h"
+#include "meshdata.h"
+#include "parallel.h"
+#include "photon_mapping.h"
+#include "radiosity.h"
+#include "raystats.h"
+#include "raytracer.h"
+
+#ifndef BENCH_SCENE_DIR
+#define BENCH_SCENE_DIR "."
+#endif
+
+// ================================================================
+
+// the scenes rendered when none are given with --scene
+constexpr const char *DEFAULT_SCENES[]{
+  "cornell_box",
+  "cornell_box_complex",
+  "cornell_box_diffuse_sphere",
+  "cornell_box_reflective_sphere",
+  "reflective_ring",
+  "reflective_spheres",
+  "tea_table",
+  "textured_plane_reflective_sphere",
+};
+
+// "0,1,2" -> {0,1,2}
+std::vector<int> ParseList(const std::string &s) {
+  std::vector<int> answer;
+  std::istringstream ss{s};
+  for (std::string item; std::getline(ss, item, ',');)
+    answer.push_back(std::stoi(item));
+  return answer;
+}
+
+// FNV-1a over the pixels, to notice when a change alters the image
+std::uint64_t HashImage(const Image &img) {
+  std::uint64_t h{0xcbf29ce484222325ULL};
+  for (int j{}; j < img.Height(); ++j)
+    for (int i{}; i < img.Width(); ++i) {
+      const Color &c{img.GetPixel(i, j)};
+      for (std::uint8_t v: {c.r, c.g, c.b})
+        h = (h ^ v) * 0x100000001b3ULL;
+    }
+  return h;
+}
+
+// the arguments of one scene, which (unlike ArgParser, in a program
+// that only ever loads the one) free the scene's mesh and renderers
+// when its runs are done, so each scene starts from the same memory
+struct SceneArgs : ArgParser {
+  using ArgParser::ArgParser;
+  ~SceneArgs() {
+    delete raytracer;
+    delete radiosity;
+    delete photon_mapping;
+    delete mesh;
+    GLOBAL_args = nullptr;
+  }
+  SceneArgs(const SceneArgs&) = delete;
+  SceneArgs& operator=(const SceneArgs&) = delete;
+};
+
+double SecondsSince(std::chrono::steady_clock::time_point start) {
+  using namespace std::chrono;
+  return duration_cast<duration<double>>(steady_clock::now() - start).count();
+}
+
+// ================================================================
+
+int main(int argc, const char *argv[]) {
+
+  // parse the command line arguments
+  std::string scene_dir{BENCH_SCENE_DIR};
+  std::vector<std::string> scenes;
+  std::string width{"128"}, height{"128"};
+  std::string seed{"1"};
+  int num_threads{};
+  std::vector<int> bounces{0, 1, 2}, shadow_samples{1, 4}, antialias_samples{1, 4};
+  for (int i = 1; i < argc; i++) {
+    if (argv[i] == std::string{"--scenes"}) {
+      i++; assert (i < argc);
+      scene_dir = argv[i];
+    } else if (argv[i] == std::string{"--scene"}) {
+      i++; assert (i < argc);
+      scenes.push_back(argv[i]);
+    } else if (argv[i] == std::string{"--size"}) {
+      i++; assert (i < argc);
+      width = argv[i];
+      i++; assert (i < argc);
+      height = argv[i];
+    } else if (argv[i] == std::string{"--threads"}) {
+      i++; assert (i < argc);
+      num_threads = atoi(argv[i]);
+      assert (num_threads >= 0);
+    } else if (argv[i] == std::string{"--seed"}) {
+      i++; assert (i < argc);
+      seed = argv[i];
+    } else if (argv[i] == std::string{"--num_bounces"}) {
+      i++; assert (i < argc);
+      bounces = ParseList(argv[i]);
+    } else if (argv[i] == std::string{"--num_shadow_samples"}) {
+      i++; assert (i < argc);
+      shadow_samples = ParseList(argv[i]);
+    } else if (argv[i] == std::string{"--num_antialias_samples"}) {
+      i++; assert (i < argc);
+      antialias_samples = ParseList(argv[i]);
+    } else {
+      std::cerr << "ERROR: unknown command line argument "
+                << i << ": '" << argv[i] << "'" << std::endl;
+      return 1;
+    }
+  }
+  if (scenes.empty())
+    scenes.assign(std::begin(DEFAULT_SCENES), std::end(DEFAULT_SCENES));
+
+  // only the JSON goes to stdout
+  std::ostream json{std::cout.rdbuf()};
+  std::cout.rdbuf(std::cerr.rdbuf());
+
+  using namespace std::chrono;
+  const std::string threads{std::to_string(num_threads)};
+  bool first_run{true};
+  json << "{\n"
+       << "  \"width\": " << width << ", \"height\": " << height
+       << ", \"seed\": " << seed << ",\n"
+       << "  \"runs\": [";
+
+  for (const auto &scene: scenes) {
+    const std::string input{(std::filesystem::path{scene_dir} / (scene + ".obj")).string()};
+    if (!std::filesystem::exists(input)) {
+      std::cerr << "ERROR: cannot find scene " << input << std::endl;
+      return 1;
+    }
+
+    // load the scene (this builds the ray tracer's BVHs too)
+    const char *args_argv[]{argv[0], "--input", input.c_str(), "--size", width.c_str(), height.c_str(),
+      "--threads", threads.c_str(), "--seed", seed.c_str(), "--headless"};
+    auto tLoad{steady_clock::now()};
+    MeshData md;
+    SceneArgs args(static_cast<int>(std::size(args_argv)), args_argv, &md);
+    const double load_time{SecondsSince(tLoad)};
+
+    // and build the BVH again on its own, to time just that
+    auto tBuild{steady_clock::now()};
+    const BVH bvh{args.mesh->getOriginalQuads(), args.mesh->getPrimitives()};
+    const double build_time{SecondsSince(tBuild)};
+
+    for (int b: bounces)
+      for (int s: shadow_samples)
+        for (int a: antialias_samples) {
+          md.num_bounces = b;
+          md.num_shadow_samples = s;
+          md.num_antialias_samples = a;
+          std::cerr << scene << ": num_bounces " << b << ", num_shadow_samples " << s
+                    << ", num_antialias_samples " << a << std::endl;
+
+          Image img{md.width, md.height};
+          const int numThreads{NumWorkerThreads()};
+          RayStats::Reset();
+          auto tRender{steady_clock::now()};
+          args.raytracer->renderImage(img, numThreads);
+          const double render_time{SecondsSince(tRender)};
+          const RayCounts rays{RayStats::Total()};
+
+          json << (first_run? "\n" : ",\n")
+               << "    {\"scene\": \"" << scene << "\", \"threads\": " << numThreads
+               << ", \"num_bounces\": " << b << ", \"num_shadow_samples\": " << s
+               << ", \"num_antialias_samples\": " << a << ",\n"
+               << "     \"bvh_nodes\": " << bvh.numNodes() << ", \"bvh_items\": " << bvh.numItems() << ",\n"
+               << "     \"rays\": {\"primary\": " << rays.primary << ", \"shadow\": " << rays.shadow
+               << ", \"indirect\": " << rays.indirect << ", \"total\": " << rays.total() << "},\n"
+               << "     \"rays_per_second\": " << rays.total() / render_time << ",\n"
+               << "     \"seconds\": {\"load\": " << load_time << ", \"bvh_build\": " << build_time
+               << ", \"render\": " << render_time << "},\n"
+               << "     \"image_hash\": \"" << std::hex << HashImage(img) << std::dec << "\"}";
+          first_run = false;
+        }
+  }
+
+  json << "\n  ]\n}" << std::endl;
+  return 0;
+}
+
+// ================================================================
@@ -41,6 +41,12 @@ public:
     double z = maximum.z() - minimum.z();
     return std::max({x, y, z});
   }
+  double surfaceArea() const {
+    double x = maximum.x() - minimum.x();
+    double y = maximum.y() - minimum.y();
+    double z = maximum.z() - minimum.z();
+    return 2 * (x*y + y*z + z*x);
+  }
 
   // =========
   // MODIFIERS
@@ -0,0 +1,204 @@
+#include <array>
+#include <limits>
+#include <algorithm>
+
+#include "bvh.h"
+#include "face.h"
+#include "primitive.h"
+#include "ray.h"
+#include "hit.h"
+
+constexpr auto NUM_BINS{16};
+constexpr auto MAX_ITEMS_PER_LEAF{4};
+constexpr auto MAX_DEPTH{64};
+// cost of visiting a node relative to intersecting a single item
+constexpr auto TRAVERSAL_COST{1.};
+
+// ==================================================================
+// CONSTRUCTION
+// ==================================================================
+
+BVH::BVH(const std::vector<Face*> &faces, const std::vector<Primitive*> &primitives): depth{} {
+  std::vector<Item> items;
+  items.reserve(faces.size() + primitives.size());
+  for (const Face *f: faces) {
+    const BoundingBox bb{f->getBoundingBox()};
+    Vec3f c; bb.getCenter(c);
+    items.push_back({bb, c, f, nullptr});
+  }
+  for (const Primitive *p: primitives) {
+    const BoundingBox bb{p->getBoundingBox()};
+    Vec3f c; bb.getCenter(c);
+    items.push_back({bb, c, nullptr, p});
+  }
+  if (items.empty()) return;
+  nodes.reserve(2 * items.size());
+  Build(items, 0, items.size(), 0);
+
+  // the building reordered the items so each leaf is a contiguous range
+  quads.reserve(items.size());
+  leaf_primitives.reserve(items.size());
+  for (const Item &item: items) {
+    quads.push_back(item.face? PackedQuad{*item.face} : PackedQuad{});
+    leaf_primitives.push_back(item.primitive);
+  }
+}
+
+
+void BVH::Build(std::vector<Item> &items, int begin, int end, int level) {
+  depth = std::max(depth, level + 1);
+  // NOTE: the recursion below may reallocate the node array, so the
+  // node is only written through its index
+  const int index = nodes.size();
+  nodes.push_back({});
+
+  BoundingBox bbox{items[begin].bbox}, centroids{items[begin].centroid};
+  for (int i{begin + 1}; i < end; ++i) {
+    bbox.Extend(items[i].bbox);
+    centroids.Extend(items[i].centroid);
+  }
+  const int count{end - begin};
+  if (count == 1 || level + 1 == MAX_DEPTH) {
+    nodes[index] = {bbox, begin, count, 0};
+    return;
+  }
+
+  // bin the item centroids along each axis and evaluate the surface
+  // area heuristic at every bin boundary
+  auto whichBin{[&] (const Item &item, int axis) {
+    const double lo{centroids.getMin()[axis]};
+    const double extent{centroids.getMax()[axis] - lo};
+    return std::min(NUM_BINS - 1, static_cast<int>(NUM_BINS * (item.centroid[axis] - lo) / extent));
+  }};
+  struct Bin {
+    BoundingBox bbox;
+    int count;
+    void add(const BoundingBox &bb, int n) {
+      if (count) bbox.Extend(bb); else bbox.Set(bb);
+      count += n;
+    }
+  };
+
+  double best_cost{std::numeric_limits<double>::max()};
+  int best_axis{-1}, best_bin{-1};
+  for (int axis{}; axis < 3; ++axis) {
+    if (centroids.getMax()[axis] <= centroids.getMin()[axis]) continue;
+    std::array<Bin, NUM_BINS> bins{};
+    for (int i{begin}; i < end; ++i)
+      bins[whichBin(items[i], axis)].add(items[i].bbox, 1);
+
+    // sweep from the right to find the cost of everything above each boundary
+    std::array<double, NUM_BINS> right_cost{};
+    Bin right{};
+    for (int b{NUM_BINS - 1}; b > 0; --b) {
+      if (bins[b].count) right.add(bins[b].bbox, bins[b].count);
+      right_cost[b] = right.count ? right.bbox.surfaceArea() * right.count : 0;
+    }
+    // then sweep from the left
+    Bin left{};
+    for (int b{}; b < NUM_BINS - 1; ++b) {
+      if (bins[b].count) left.add(bins[b].bbox, bins[b].count);
+      if (!left.count || left.count == count) continue;
+      const double cost{left.bbox.surfaceArea() * left.count + right_cost[b + 1]};
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_bin = b;
+      }
+    }
+  }
+
+  int middle;
+  if (best_axis < 0) {
+    // all of the centroids coincide, so no split separates them
+    if (count <= MAX_ITEMS_PER_LEAF) {
+      nodes[index] = {bbox, begin, count, 0};
+      return;
+    }
+    best_axis = 0;
+    middle = begin + count / 2;
+  } else {
+    const double area{bbox.surfaceArea()};
+    if (count <= MAX_ITEMS_PER_LEAF && count * area <= TRAVERSAL_COST * area + best_cost) {
+      nodes[index] = {bbox, begin, count, 0};
+      return;
+    }
+    middle = std::partition(items.begin() + begin, items.begin() + end,
+      [&] (const Item &item) { return whichBin(item, best_axis) <= best_bin; }) - items.begin();
+  }
+  assert (middle > begin && middle < end);
+
+  Build(items, begin, middle, level + 1);
+  const int second = nodes.size();
+  Build(items, middle, end, level + 1);
+  nodes[index] = {bbox, second, 0, best_axis};
+}
+
+// ==================================================================
+// TRAVERSAL
+// ==================================================================
+
+// slab test of the ray against the box, limited to the segment [0, t_max]
+bool HitsBox(const BoundingBox &bb, const Vec3f &origin, const Vec3f &inv_dir, float t_max) {
+  double t0{0}, t1{t_max};
+  for (int axis{}; axis < 3; ++axis) {
+    double t_near{(bb.getMin()[axis] - origin[axis]) * inv_dir[axis]};
+    double t_far{(bb.getMax()[axis] - origin[axis]) * inv_dir[axis]};
+    if (t_near > t_far) std::swap(t_near, t_far);
+    t0 = std::max(t0, t_near);
+    t1 = std::min(t1, t_far);
+    if (t0 > t1) return false;
+  }
+  return true;
+}
+
+template<class TMax, class Visit>
+bool BVH::Traverse(const Ray &r, TMax tMax, Visit visit) const {
+  if (nodes.empty()) return false;
+  const Vec3f &origin = r.getOrigin();
+  const Vec3f &dir = r.getDirection();
+  const Vec3f inv_dir{1 / dir.x(), 1 / dir.y(), 1 / dir.z()};
+
+  // explicitly store the stack of nodes that must be checked (rather
+  // than write a recursive function)
+  std::array<int, MAX_DEPTH + 1> todo;
+  int num_todo{};
+  todo[num_todo++] = 0;
+  while (num_todo) {
+    const int index{todo[--num_todo]};
+    const Node &node = nodes[index];
+    if (!HitsBox(node.bbox, origin, inv_dir, tMax())) continue;
+    if (node.count) {
+      for (int i{node.first}; i < node.first + node.count; ++i)
+        if (visit(i)) return true;
+      continue;
+    }
+    // push the farther child first, so the nearer one is visited first
+    // (for closest hits this shrinks tMax() before the other is tested)
+    const bool second_first{dir[node.axis] < 0};
+    todo[num_todo++] = second_first? index + 1 : node.first;
+    todo[num_todo++] = second_first? node.first : index + 1;
+  }
+  return false;
+}
+
+bool BVH::intersect(const Ray &r, Hit &h, bool intersect_backfacing) const {
+  bool answer = false;
+  Traverse(r, [&] { return h.getT(); }, [&] (int i) {
+    answer |= leaf_primitives[i]?
+      leaf_primitives[i]->intersect(r, h) :
+      quads[i].intersect(r, h, intersect_backfacing);
+    return false;
+  });
+  return answer;
+}
+
+bool BVH::occluded(const Ray &r, float t_max, bool intersect_backfacing) const {
+  return Traverse(r, [=] { return t_max; }, [&] (int i) {
+    return leaf_primitives[i]?
+      leaf_primitives[i]->occludes(r, t_max) :
+      quads[i].occludes(r, t_max, intersect_backfacing);
+  });
+}
+
+// ==================================================================
@@ -0,0 +1,76 @@
+#ifndef _BVH_H_
+#define _BVH_H_
+
+#include <vector>
+#include "boundingbox.h"
+#include "packed_quad.h"
+
+class Face;
+class Primitive;
+class Ray;
+class Hit;
+
+// ==================================================================
+// A bounding volume hierarchy over the scene geometry used for ray
+// casting.  The tree is built once with the surface area heuristic
+// (SAH) and stored as a flat array of nodes in depth first order, so
+// the first child of an interior node directly follows its parent.
+// The quads are copied into the leaves as PackedQuads, so a ray never
+// touches the half-edge mesh.
+
+class BVH {
+ public:
+
+  // ===========
+  // CONSTRUCTOR
+  BVH(const std::vector<Face*> &faces, const std::vector<Primitive*> &primitives);
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] std::size_t numNodes() const { return nodes.size(); }
+  // (the quads and the primitives, one per leaf slot)
+  [[nodiscard]] std::size_t numItems() const { return quads.size(); }
+  [[nodiscard]] int getDepth() const { return depth; }
+
+  // find the closest intersection (closer than h.getT()) along the ray
+  bool intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
+  // is there any intersection along the ray before t_max?
+  [[nodiscard]] bool occluded(const Ray &r, float t_max, bool intersect_backfacing) const;
+
+ private:
+
+  // a face or a primitive, along with its bounds (only used while building)
+  struct Item {
+    BoundingBox bbox;
+    Vec3f centroid;
+    const Face *face;
+    const Primitive *primitive;
+  };
+
+  struct Node {
+    BoundingBox bbox;
+    // leaf:      items [first, first+count)
+    // interior:  second child at nodes[first], count == 0
+    int first;
+    int count;
+    // the split axis, used to visit the nearer child first
+    int axis;
+  };
+
+  // HELPER FUNCTIONS
+  // recursively builds the subtree over items [begin, end)
+  void Build(std::vector<Item> &items, int begin, int end, int level);
+  // visits the item indices of every leaf the ray reaches before tMax(),
+  // stopping (and returning true) as soon as visit returns true
+  template<class TMax, class Visit> bool Traverse(const Ray &r, TMax tMax, Visit visit) const;
+
+  // REPRESENTATION
+  std::vector<Node> nodes;
+  // the leaf contents, in leaf order:  item i is quads[i], unless
+  // leaf_primitives[i] is not null
+  std::vector<PackedQuad> quads;
+  std::vector<const Primitive*> leaf_primitives;
+  int depth;
+};
+
+#endif
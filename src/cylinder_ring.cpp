@@ -9,6 +9,7 @@
 #include "meshdata.h"
 #include "ray.h"
 #include "hit.h"
+#include "boundingbox.h"
 
 // ====================================================================
 // ====================================================================
@@ -114,6 +115,22 @@ bool CylinderRing::intersect(const Ray &r, Hit &h) const {
   return answer;
 } 
 
+bool CylinderRing::occludes(const Ray &r, float t_max) const {
+  // any of the 4 parts of the ring will do
+  float t;
+  Vec3f normal;
+  return
+    (IntersectFiniteCylinder(r,center,outer_radius,height,t,normal) && t < t_max) ||
+    (IntersectFiniteCylinder(r,center,inner_radius,height,t,normal) && t < t_max) ||
+    (IntersectAnnulus(r,center+Vec3f{0,height/2.0,0},inner_radius,outer_radius,t,normal) && t < t_max) ||
+    (IntersectAnnulus(r,center-Vec3f{0,height/2.0,0},inner_radius,outer_radius,t,normal) && t < t_max);
+}
+
+BoundingBox CylinderRing::getBoundingBox() const {
+  const Vec3f r{outer_radius,height/2.0,outer_radius};
+  return {center-r,center+r};
+}
+
 // ====================================================================
 // ====================================================================
 
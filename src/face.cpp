@@ -1,7 +1,7 @@
 #include "utils.h"
-#include "matrix.h"
 #include "face.h"
 #include "argparser.h"
+#include "boundingbox.h"
 
 // =========================================================================
 // =========================================================================
@@ -26,6 +26,14 @@ float Face::getArea() const {
     );
 }
 
+BoundingBox Face::getBoundingBox() const {
+  auto vs{getVertices()};
+  BoundingBox bb{vs[0]->get()};
+  for (int i = 1; i < 4; i++)
+    bb.Extend(vs[i]->get());
+  return bb;
+}
+
 // =========================================================================
 
 Vec3f Face::randPoint() const {
@@ -59,92 +67,6 @@ std::array<std::size_t, 2> Face::sampleLayout(std::size_t n) const {
   };
 }
 
-// =========================================================================
-// the intersection routines
-
-bool Face::intersect(const Ray &r, Hit &h, bool intersect_backfacing) const {
-  // intersect with each of the subtriangles
-  auto [a, b, c, d]{getVertices()};
-  return triangle_intersect(r,h,a,b,c,intersect_backfacing) || triangle_intersect(r,h,a,c,d,intersect_backfacing);
-}
-
-bool Face::triangle_intersect(const Ray &r, Hit &h, Vertex *a, Vertex *b, Vertex *c, bool intersect_backfacing) const {
-
-  // compute the intersection with the plane of the triangle
-  Hit h2 = h;
-  if (!plane_intersect(r,h2,intersect_backfacing)) return 0;
-
-  // figure out the barycentric coordinates:
-  Vec3f Ro = r.getOrigin();
-  Vec3f Rd = r.getDirection();
-  // [ ax-bx   ax-cx  Rdx ][ beta  ]     [ ax-Rox ]
-  // [ ay-by   ay-cy  Rdy ][ gamma ]  =  [ ay-Roy ]
-  // [ az-bz   az-cz  Rdz ][ t     ]     [ az-Roz ]
-  // solve for beta, gamma, & t using Cramer's rule
-
-  float detA = Matrix::det3x3(a->get().x()-b->get().x(),a->get().x()-c->get().x(),Rd.x(),
-                              a->get().y()-b->get().y(),a->get().y()-c->get().y(),Rd.y(),
-                              a->get().z()-b->get().z(),a->get().z()-c->get().z(),Rd.z());
-
-  if (fabs(detA) <= 0.000001) return 0;
-  assert (fabs(detA) >= 0.000001);
-
-  float beta = Matrix::det3x3(a->get().x()-Ro.x(),a->get().x()-c->get().x(),Rd.x(),
-                              a->get().y()-Ro.y(),a->get().y()-c->get().y(),Rd.y(),
-                              a->get().z()-Ro.z(),a->get().z()-c->get().z(),Rd.z()) / detA;
-  float gamma = Matrix::det3x3(a->get().x()-b->get().x(),a->get().x()-Ro.x(),Rd.x(),
-                               a->get().y()-b->get().y(),a->get().y()-Ro.y(),Rd.y(),
-                               a->get().z()-b->get().z(),a->get().z()-Ro.z(),Rd.z()) / detA;
-
-  if (beta >= -0.00001 && beta <= 1.00001 &&
-      gamma >= -0.00001 && gamma <= 1.00001 &&
-      beta + gamma <= 1.00001) {
-    h = h2;
-    // interpolate the texture coordinates
-    float alpha = 1 - beta - gamma;
-    float t_s = alpha * a->get_s() + beta * b->get_s() + gamma * c->get_s();
-    float t_t = alpha * a->get_t() + beta * b->get_t() + gamma * c->get_t();
-    h.setTextureCoords(t_s,t_t);
-    assert (h.getT() >= EPSILON);
-    return 1;
-  }
-
-  return 0;
-}
-
-
-bool Face::plane_intersect(const Ray &r, Hit &h, bool intersect_backfacing) const {
-
-  // insert the explicit equation for the ray into the implicit equation of the plane
-
-  // equation for a plane
-  // ax + by + cz = d;
-  // normal . p + direction = 0
-  // plug in ray
-  // origin + direction * t = p(t)
-  // origin . normal + t * direction . normal = d;
-  // t = d - origin.normal / direction.normal;
-
-  Vec3f normal = computeNormal();
-  float d = normal.Dot3((*this)[0]->get());
-
-  float numer = d - r.getOrigin().Dot3(normal);
-  float denom = r.getDirection().Dot3(normal);
-
-  if (denom == 0) return 0;  // parallel to plane
-
-  if (!intersect_backfacing && normal.Dot3(r.getDirection()) >= 0)
-    return 0; // hit the backside
-
-  float t = numer / denom;
-  if (t > EPSILON && t < h.getT()) {
-    h.set(t,this->getMaterial(),normal);
-    assert (h.getT() >= EPSILON);
-    return 1;
-  }
-  return 0;
-}
-
 Vec3f Face::computeNormal() const {
   // note: this face might be non-planar, so average the two triangle normals
   auto vs{getVertices()};
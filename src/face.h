@@ -8,6 +8,7 @@
 #include "hit.h"
 
 class Material;
+class BoundingBox;
 
 // ==============================================================
 // Simple class to store quads for use in radiosity & raytracing.
@@ -56,6 +57,7 @@ public:
   [[nodiscard]] float getArea() const;
   [[nodiscard]] Vec3f randPoint() const;
   [[nodiscard]] Vec3f computeNormal() const;
+  [[nodiscard]] BoundingBox getBoundingBox() const;
 
   // =========
   // MODIFIERS
@@ -67,7 +69,7 @@ public:
 
   // ==========
   // RAYTRACING
-  bool intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
+  // (rays are intersected with the PackedQuad copies in the BVH)
   /* Intended to be a suggestion for sampling layout for rectangular faces */
   [[nodiscard]] std::array<std::size_t, 2> sampleLayout(std::size_t n) const;
 
@@ -78,10 +80,6 @@ public:
 
 protected:
 
-  // helper functions
-  bool triangle_intersect(const Ray &r, Hit &h, Vertex *a, Vertex *b, Vertex *c, bool intersect_backfacing) const;
-  bool plane_intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
-
   Face& operator=(const Face&) = delete;
 
   // ==============
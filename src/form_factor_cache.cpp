@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <iomanip>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "form_factor_cache.h"
+#include "form_factors.h"
+#include "mesh.h"
+#include "meshdata.h"
+#include "face.h"
+
+// ====================================================================
+// The file:  this header, the patch areas, and then (starting on a
+// 64 byte boundary, for the row loops) either the n x n matrix or
+// SparseFormFactors::write.
+namespace {
+
+constexpr char MAGIC[8]{'F', 'F', 'C', 'A', 'C', 'H', 'E', '\0'};
+// (bump when anything written changes)
+constexpr std::uint32_t VERSION{1};
+
+struct Header {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t num_patches;
+  std::uint64_t key;
+  std::uint32_t sparse;
+  std::uint32_t unused;
+  std::uint64_t matrix_offset;
+  std::uint64_t matrix_size;
+};
+
+std::uint64_t matrixOffset(int n) {
+  return (sizeof(Header) + n * sizeof(float) + 63) / 64 * 64;
+}
+
+}
+
+// ====================================================================
+
+std::uint64_t FormFactorKey(const Mesh &mesh, const MeshData &mesh_data, bool sparse) {
+  // FNV-1a, over the bytes of each value
+  std::uint64_t hash{14695981039346656037ULL};
+  auto add{[&] (const auto &value) {
+    const auto *bytes{reinterpret_cast<const unsigned char*>(&value)};
+    for (std::size_t k{}; k < sizeof(value); ++k) {
+      hash ^= bytes[k];
+      hash *= 1099511628211ULL;
+    }
+  }};
+
+  add(VERSION);
+  add(mesh.numFaces());
+  add(mesh.numSubdivisions());
+  // (in radiosity patch order)
+  for (int i{}; i < mesh.numFaces(); ++i)
+    for (const Vertex *v: mesh.getFace(i)->getVertices()) {
+      const Vec3f &p{v->get()};
+      add(p.x());
+      add(p.y());
+      add(p.z());
+    }
+  add(mesh_data.form_factor_method);
+  if (mesh_data.form_factor_method == FORM_FACTORS_HEMICUBE) {
+    add(mesh_data.hemicube_resolution);
+  } else {
+    add(std::max(1, mesh_data.num_form_factor_samples));
+    add(mesh_data.intersect_backfacing);
+  }
+  add(sparse);
+  return hash;
+}
+
+// ====================================================================
+
+FormFactorCache::FormFactorCache(const std::string &directory, std::uint64_t k):
+  key{k},
+  mapping{},
+  mapping_size{}
+{
+  std::ostringstream name;
+  name << "formfactors_" << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+  path = (std::filesystem::path{directory} / name.str()).string();
+}
+
+FormFactorCache::~FormFactorCache() {
+  unmap();
+}
+
+void FormFactorCache::unmap() {
+#ifndef _WIN32
+  if (mapping != nullptr)
+    munmap(mapping, mapping_size);
+#endif
+  mapping = nullptr;
+  mapping_size = 0;
+  contents.clear();
+  contents.shrink_to_fit();
+}
+
+// ====================================================================
+
+bool FormFactorCache::load(int n, const float *areas, float *&dense, SparseFormFactors *&sparse) {
+  assert (mapping == nullptr && contents.empty());
+  const char *data;
+  std::size_t size;
+#ifndef _WIN32
+  // (private, so the radiosity can normalize rows in place without
+  // writing through to the file)
+  const int fd{open(path.c_str(), O_RDONLY)};
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+    close(fd);
+    return false;
+  }
+  void *m{mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)};
+  close(fd);
+  if (m == MAP_FAILED) return false;
+  mapping = m;
+  mapping_size = st.st_size;
+  data = static_cast<const char*>(mapping);
+  size = mapping_size;
+#else
+  std::ifstream in{path, std::ios::binary};
+  if (!in) return false;
+  contents.assign(std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{});
+  data = contents.data();
+  size = contents.size();
+#endif
+
+  // is it this scene's, and all there?
+  Header header;
+  bool ok{size >= sizeof(Header)};
+  if (ok) {
+    std::memcpy(&header, data, sizeof(Header));
+    ok = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION &&
+      header.num_patches == static_cast<std::uint32_t>(n) && header.key == key &&
+      header.matrix_offset == matrixOffset(n) && header.matrix_offset <= size &&
+      header.matrix_size <= size - header.matrix_offset &&
+      (header.sparse || header.matrix_size == std::uint64_t(n) * n * sizeof(float));
+  }
+  // (and in case of a collision, the patches had better be the same size)
+  if (ok) {
+    const float *cached{reinterpret_cast<const float*>(data + sizeof(Header))};
+    for (int i{}; ok && i < n; ++i)
+      ok = std::abs(cached[i] - areas[i]) <= 1e-5f * std::max(std::abs(areas[i]), 1e-20f);
+  }
+
+  if (ok && !header.sparse) {
+    dense = reinterpret_cast<float*>(const_cast<char*>(data) + header.matrix_offset);
+    return true;
+  }
+  if (ok) sparse = SparseFormFactors::read(data + header.matrix_offset, header.matrix_size);
+  unmap();
+  return ok && sparse != nullptr;
+}
+
+void FormFactorCache::save(int n, const float *areas, const float *dense, const SparseFormFactors *sparse) const {
+  assert ((dense == nullptr) != (sparse == nullptr));
+  // (written beside it and then renamed into place, so that nothing
+  // ever reads a partly written file)
+  const std::filesystem::path file{path};
+  const std::string temporary{path + ".tmp"};
+  std::error_code error;
+  std::filesystem::create_directories(file.parent_path(), error);
+  std::ofstream out{temporary, std::ios::binary};
+
+  Header header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.num_patches = n;
+  header.key = key;
+  header.sparse = sparse != nullptr;
+  header.matrix_offset = matrixOffset(n);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  out.write(reinterpret_cast<const char*>(areas), n * sizeof(float));
+  const std::vector<char> padding(header.matrix_offset - sizeof(Header) - n * sizeof(float));
+  out.write(padding.data(), padding.size());
+  if (dense != nullptr)
+    out.write(reinterpret_cast<const char*>(dense), std::size_t(n) * n * sizeof(float));
+  else
+    sparse->write(out);
+
+  // (now that its size is known)
+  header.matrix_size = static_cast<std::uint64_t>(out.tellp()) - header.matrix_offset;
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  out.close();
+  if (!out || std::rename(temporary.c_str(), path.c_str()) != 0) {
+    std::cerr << "WARNING: couldn't save the form factors to " << path << std::endl;
+    std::remove(temporary.c_str());
+  }
+}
+
+// ====================================================================
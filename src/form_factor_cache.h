@@ -0,0 +1,64 @@
+#ifndef _FORM_FACTOR_CACHE_H_
+#define _FORM_FACTOR_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Mesh;
+class SparseFormFactors;
+struct MeshData;
+
+// ====================================================================
+// ====================================================================
+// The form factors of a scene, saved to a file in a cache directory so
+// the next run with the same patches can start iterating right away.
+// The file is named for a hash of everything the form factors depend
+// on (see FormFactorKey), and also records the patch areas, which are
+// checked on load in case two scenes hash the same.  A dense matrix is
+// memory mapped (copy on write) rather than read in, so it is paged in
+// only as the rows are used.
+
+// the patch corners, the subdivision, and the form factor parameters
+// (but not the seed:  the form factors of any seed will do)
+[[nodiscard]] std::uint64_t FormFactorKey(const Mesh &mesh, const MeshData &mesh_data, bool sparse);
+
+class FormFactorCache {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  FormFactorCache(const std::string &directory, std::uint64_t key);
+  ~FormFactorCache();
+  FormFactorCache(const FormFactorCache&) = delete;
+  FormFactorCache& operator=(const FormFactorCache&) = delete;
+
+  [[nodiscard]] const std::string& getPath() const { return path; }
+
+  // The form factors for n patches with these areas, if they're in the
+  // cache:  either a dense matrix, which stays in the cache's mapping
+  // (so the cache has to outlive it), or sparse ones, which don't.
+  [[nodiscard]] bool load(int n, const float *areas, float *&dense, SparseFormFactors *&sparse);
+  // one or the other of dense and sparse
+  void save(int n, const float *areas, const float *dense, const SparseFormFactors *sparse) const;
+
+private:
+
+  void unmap();
+
+  // REPRESENTATION
+  std::string path;
+  std::uint64_t key;
+  // the file, while it's loaded
+  void *mapping;
+  std::size_t mapping_size;
+  // (or a copy of it, where files can't be mapped)
+  std::vector<char> contents;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
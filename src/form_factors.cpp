@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <tuple>
+#include <utility>
+
+#include "form_factors.h"
+#include "parallel.h"
+
+// ================================================================
+
+SparseFormFactors::Row SparseFormFactors::Quantize(const std::vector<float> &row) {
+  const int n = row.size();
+  const float largest{n > 0? *std::max_element(row.begin(), row.end()) : 0};
+  Row quantized{{}, {}, 0};
+  if (!(largest > 0)) return quantized;
+  auto quantize{[&] (float k) -> std::uint16_t { return std::lround(k / largest * 65535); }};
+
+  // (a column index and a value per entry, or just a value per column)
+  std::size_t count{};
+  for (const float k: row)
+    count += quantize(k) > 0;
+  if (count * (sizeof(int) + sizeof(std::uint16_t)) > n * sizeof(std::uint16_t)) {
+    quantized.value.resize(n);
+    for (int j{}; j < n; ++j)
+      quantized.value[j] = quantize(row[j]);
+  } else {
+    quantized.column.reserve(count);
+    quantized.value.reserve(count);
+    for (int j{}; j < n; ++j)
+      if (const std::uint16_t q{quantize(row[j])}; q > 0) {
+        quantized.column.push_back(j);
+        quantized.value.push_back(q);
+      }
+  }
+  std::uint64_t total{};
+  for (const std::uint16_t q: quantized.value)
+    total += q;
+  quantized.scale = 1.f / total;
+  return quantized;
+}
+
+SparseFormFactors::SparseFormFactors(std::vector<Row> rows) {
+  const int n = rows.size();
+  row_start.resize(n + 1);
+  column_start.resize(n + 1);
+  row_scale.resize(n);
+  for (int i{}; i < n; ++i) {
+    row_start[i + 1] = row_start[i] + rows[i].value.size();
+    column_start[i + 1] = column_start[i] + rows[i].column.size();
+    row_scale[i] = rows[i].scale;
+  }
+  column.resize(column_start[n]);
+  value.resize(row_start[n]);
+  for (int i{}; i < n; ++i) {
+    // (an empty row isn't stored whole)
+    assert (rows[i].column.size() == rows[i].value.size() ||
+            (rows[i].column.empty() && rows[i].value.size() == static_cast<std::size_t>(n)));
+    std::copy(rows[i].column.begin(), rows[i].column.end(), column.begin() + column_start[i]);
+    std::copy(rows[i].value.begin(), rows[i].value.end(), value.begin() + row_start[i]);
+    rows[i] = {};
+  }
+}
+
+SparseFormFactors::SparseFormFactors(int n, const UpperRow &upper) {
+  // the first pass:  how many entries each row gets, and the largest
+  // (each k of row i is F_ij and its mirror F_ji)
+  const std::unique_ptr<std::atomic<std::size_t>[]> count{new std::atomic<std::size_t>[n]{}};
+  const std::unique_ptr<std::atomic<float>[]> largest{new std::atomic<float>[n]{}};
+  auto measure{[&] (int row, float k) {
+    count[row].fetch_add(1, std::memory_order_relaxed);
+    float l{largest[row].load(std::memory_order_relaxed)};
+    while (k > l && !largest[row].compare_exchange_weak(l, k, std::memory_order_relaxed)) {}
+  }};
+  ParallelFor(n, [&] (int i, int) {
+    upper(i, [&] (int j, float k) {
+      measure(i, k);
+      measure(j, k);
+    });
+  });
+
+  // (a column index and a value per entry, or just a value per column;
+  // an entry too small for 16 bits still keeps its place, as a 0)
+  row_start.resize(n + 1);
+  column_start.resize(n + 1);
+  for (int i{}; i < n; ++i) {
+    const std::size_t c{count[i].load(std::memory_order_relaxed)};
+    const bool whole{c * (sizeof(int) + sizeof(std::uint16_t)) > n * sizeof(std::uint16_t)};
+    row_start[i + 1] = row_start[i] + (whole? n : c);
+    column_start[i + 1] = column_start[i] + (whole? 0 : c);
+  }
+  column.resize(column_start[n]);
+  value.resize(row_start[n]);
+
+  // The second pass fills them in.  The entries of a row come from
+  // many threads, in no particular order, so each takes the next free
+  // place in its row, and the rows are sorted after.
+  const std::unique_ptr<std::atomic<std::size_t>[]> next{new std::atomic<std::size_t>[n]{}};
+  auto append{[&] (int row, int col, float k) {
+    const std::uint16_t q = std::lround(k / largest[row].load(std::memory_order_relaxed) * 65535);
+    if (isWhole(row)) {
+      value[row_start[row] + col] = q;
+    } else {
+      const std::size_t at{next[row].fetch_add(1, std::memory_order_relaxed)};
+      column[column_start[row] + at] = col;
+      value[row_start[row] + at] = q;
+    }
+  }};
+  ParallelFor(n, [&] (int i, int) {
+    upper(i, [&] (int j, float k) {
+      append(i, j, k);
+      append(j, i, k);
+    });
+  });
+
+  // Then each row is sorted by column and normalized.  (Summing the
+  // quantized values, which are integers, makes the sums the same
+  // whichever threads added to them, and makes the rows sum to 1 as
+  // stored.)
+  row_scale.resize(n);
+  ParallelFor(n, [&] (int i, int) {
+    thread_local std::vector<std::pair<int, std::uint16_t>> entries;
+    if (!isWhole(i)) {
+      assert (next[i].load() == count[i].load());
+      entries.clear();
+      for (std::size_t e{column_start[i]}, v{row_start[i]}; e < column_start[i + 1]; ++e, ++v)
+        entries.emplace_back(column[e], value[v]);
+      std::sort(entries.begin(), entries.end());
+      for (std::size_t e{column_start[i]}, v{row_start[i]}, m{}; e < column_start[i + 1]; ++e, ++v, ++m)
+        std::tie(column[e], value[v]) = entries[m];
+    }
+    std::uint64_t total{};
+    for (std::size_t v{row_start[i]}; v < row_start[i + 1]; ++v)
+      total += value[v];
+    row_scale[i] = total > 0? 1.f / total : 0;
+  });
+}
+
+// ================================================================
+
+float SparseFormFactors::get(int i, int j) const {
+  assert (i >= 0 && i < numRows());
+  assert (j >= 0 && j < numRows());
+  if (isWhole(i))
+    return value[row_start[i] + j] * row_scale[i];
+  const auto begin{column.begin() + column_start[i]}, end{column.begin() + column_start[i + 1]};
+  const auto it{std::lower_bound(begin, end, j)};
+  if (it == end || *it != j) return 0;
+  return value[row_start[i] + (it - begin)] * row_scale[i];
+}
+
+Vec3f SparseFormFactors::gather(int i, const float *r, const float *g, const float *b) const {
+  assert (i >= 0 && i < numRows());
+  const std::uint16_t *v{value.data() + row_start[i]};
+  float sr{}, sg{}, sb{};
+  if (isWhole(i)) {
+    const int n{numRows()};
+    for (int j{}; j < n; ++j) {
+      sr += v[j] * r[j];
+      sg += v[j] * g[j];
+      sb += v[j] * b[j];
+    }
+  } else {
+    const int *c{column.data() + column_start[i]};
+    const int count = column_start[i + 1] - column_start[i];
+    for (int k{}; k < count; ++k) {
+      sr += v[k] * r[c[k]];
+      sg += v[k] * g[c[k]];
+      sb += v[k] * b[c[k]];
+    }
+  }
+  return row_scale[i] * Vec3f{sr, sg, sb};
+}
+
+// ================================================================
+
+// each array as its length and then its elements
+namespace {
+
+template <typename T>
+void writeArray(std::ostream &out, const std::vector<T> &v) {
+  const std::uint64_t size{v.size()};
+  out.write(reinterpret_cast<const char*>(&size), sizeof(size));
+  out.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+template <typename T>
+bool readArray(const char *&data, const char *end, std::vector<T> &v) {
+  std::uint64_t size;
+  if (end - data < static_cast<std::ptrdiff_t>(sizeof(size))) return false;
+  std::memcpy(&size, data, sizeof(size));
+  data += sizeof(size);
+  if (size > static_cast<std::uint64_t>(end - data) / sizeof(T)) return false;
+  v.resize(size);
+  if (size > 0) std::memcpy(v.data(), data, size * sizeof(T));
+  data += size * sizeof(T);
+  return true;
+}
+
+}
+
+void SparseFormFactors::write(std::ostream &out) const {
+  writeArray(out, row_start);
+  writeArray(out, column_start);
+  writeArray(out, column);
+  writeArray(out, value);
+  writeArray(out, row_scale);
+}
+
+SparseFormFactors* SparseFormFactors::read(const char *data, std::size_t size) {
+  const char *end{data + size};
+  SparseFormFactors *sparse{new SparseFormFactors};
+  bool ok{readArray(data, end, sparse->row_start) && readArray(data, end, sparse->column_start) &&
+          readArray(data, end, sparse->column) && readArray(data, end, sparse->value) &&
+          readArray(data, end, sparse->row_scale)};
+  // (enough that get and gather stay in bounds)
+  const std::size_t n{sparse->row_scale.size()};
+  ok = ok && sparse->row_start.size() == n + 1 && sparse->column_start.size() == n + 1 &&
+    sparse->row_start[0] == 0 && sparse->column_start[0] == 0 &&
+    sparse->row_start[n] == sparse->value.size() && sparse->column_start[n] == sparse->column.size();
+  for (std::size_t i{}; ok && i < n; ++i) {
+    const std::size_t values{sparse->row_start[i + 1] - sparse->row_start[i]};
+    const std::size_t columns{sparse->column_start[i + 1] - sparse->column_start[i]};
+    ok = sparse->row_start[i] <= sparse->row_start[i + 1] && sparse->column_start[i] <= sparse->column_start[i + 1] &&
+      (columns == values || (columns == 0 && values == n));
+    for (std::size_t k{sparse->column_start[i]}; ok && k < sparse->column_start[i + 1]; ++k)
+      ok = sparse->column[k] >= 0 && static_cast<std::size_t>(sparse->column[k]) < n;
+  }
+  if (!ok) {
+    delete sparse;
+    return nullptr;
+  }
+  return sparse;
+}
+
+// ================================================================
@@ -0,0 +1,100 @@
+#ifndef _FORM_FACTORS_H_
+#define _FORM_FACTORS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <vector>
+#include "vectors.h"
+
+// ====================================================================
+// ====================================================================
+// Form factors for scenes with too many patches for a dense n x n
+// matrix.  Most pairs of patches can't see each other (they're
+// occluded, or facing away), so only the nonzero entries of each row
+// are kept, in compressed sparse row (CSR) order.  Each entry is
+// stored as a 16 bit fraction of the largest entry in its row.  A row
+// that is more than a third full is smaller without the column
+// indices, so it is stored whole instead.
+
+class SparseFormFactors {
+
+public:
+
+  // a row quantized on its own (see Quantize):  the columns of its
+  // values in order (none if it's whole), and the scale that makes
+  // them F_ij
+  struct Row {
+    std::vector<int> column;
+    std::vector<std::uint16_t> value;
+    float scale;
+  };
+
+  // calls entry(j, k) for each nonzero k of row i, the same ones every
+  // time
+  using UpperRow = std::function<void(int i, const std::function<void(int j, float k)> &entry)>;
+
+  // ============
+  // CONSTRUCTORS
+  // Both normalize every row to sum to 1.  From rows that were each
+  // computed whole (each is freed once it's copied in):
+  explicit SparseFormFactors(std::vector<Row> rows);
+  // Or from the n rows of the upper triangle (j > i) of a symmetric
+  // matrix, like the integral of the kernel over both patches (see
+  // Radiosity::ComputeFormFactors), with the lower triangle filled in
+  // from it.  Each row is computed (on the worker threads) twice:
+  // once to find the size of each row and the largest entry it gets,
+  // and then again to fill it in.  Nothing but the result and a few
+  // numbers per row is ever kept, at the cost of computing it all
+  // twice:  for the ray cast form factors, every pair is integrated
+  // twice, which takes about twice as long as the dense matrix.  Where
+  // that fits in memory, it's the faster choice.
+  SparseFormFactors(int n, const UpperRow &upper);
+
+  // a whole row (F_ij for every j, most of them 0), ready for the first
+  // constructor
+  [[nodiscard]] static Row Quantize(const std::vector<float> &row);
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] int numRows() const { return static_cast<int>(row_scale.size()); }
+  [[nodiscard]] std::size_t numBytes() const {
+    return (row_start.size() + column_start.size()) * sizeof(std::size_t) + column.size() * sizeof(int) +
+      value.size() * sizeof(std::uint16_t) + row_scale.size() * sizeof(float); }
+  // F_ij, or 0 if it wasn't stored
+  [[nodiscard]] float get(int i, int j) const;
+  // the sum over j of F_ij (r_j, g_j, b_j)
+  [[nodiscard]] Vec3f gather(int i, const float *r, const float *g, const float *b) const;
+
+  // ===========
+  // PERSISTENCE
+  // the representation as is, for FormFactorCache
+  void write(std::ostream &out) const;
+  // what write wrote, or nullptr if it's cut short or inconsistent
+  [[nodiscard]] static SparseFormFactors* read(const char *data, std::size_t size);
+
+private:
+
+  SparseFormFactors() = default;
+
+  // is row i stored whole (rather than just its nonzero entries)?
+  [[nodiscard]] bool isWhole(int i) const {
+    return row_start[i + 1] - row_start[i] > column_start[i + 1] - column_start[i]; }
+
+  // REPRESENTATION
+  // the values of row i are value[row_start[i], row_start[i+1]), with
+  // their columns at column[column_start[i], column_start[i+1]),
+  // sorted.  A whole row has no columns and a value for every column.
+  std::vector<std::size_t> row_start;
+  std::vector<std::size_t> column_start;
+  std::vector<int> column;
+  std::vector<std::uint16_t> value;
+  // F_ij = value * row_scale[i]
+  std::vector<float> row_scale;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include "hemicube.h"
+#include "utils.h"
+
+// ====================================================================
+
+Hemicube::Hemicube(int res):
+  // (even, so the sides are exactly half as tall)
+  resolution{res + res % 2},
+  top_delta(resolution * resolution),
+  side_delta(resolution * resolution / 2),
+  depth(resolution * resolution),
+  item(resolution * resolution)
+{
+  assert (resolution > 0);
+  // on a hemicube of half width 1 around the patch, the pixel at (x,y)
+  // on top covers dA / (pi (x^2 + y^2 + 1)^2) of the form factor, and
+  // the pixel at height z on a side covers z dA / (pi (x^2 + z^2 + 1)^2)
+  const float pixel{2.f / resolution};
+  const float dA{pixel * pixel};
+  for (int py{}; py < resolution; ++py)
+    for (int px{}; px < resolution; ++px) {
+      const float x{-1 + (px + .5f) * pixel}, y{-1 + (py + .5f) * pixel};
+      const float r2{x * x + y * y + 1};
+      top_delta[py * resolution + px] = dA / (M_PI * r2 * r2);
+    }
+  for (int py{}; py < resolution / 2; ++py)
+    for (int px{}; px < resolution; ++px) {
+      const float x{-1 + (px + .5f) * pixel}, z{(py + .5f) * pixel};
+      const float r2{x * x + z * z + 1};
+      side_delta[py * resolution + px] = z * dA / (M_PI * r2 * r2);
+    }
+}
+
+// ====================================================================
+
+void Hemicube::computeRow(const std::vector<Quad> &patches, int i, const Vec3f &center, const Vec3f &normal,
+                          std::vector<float> &row) {
+  assert (row.size() == patches.size());
+  // any two axes perpendicular to the normal will do
+  const Vec3f n{normal.Normalized()};
+  Vec3f u, v;
+  Vec3f::Cross3(u, n, std::abs(n.x()) < .5? Vec3f{1, 0, 0} : Vec3f{0, 1, 0});
+  u.Normalize();
+  Vec3f::Cross3(v, n, u);
+
+  // only the patches at least partly above patch i's plane can show up
+  // (which also keeps patches edge on to it from leaking onto the sides)
+  in_front.clear();
+  const int num_patches = patches.size();
+  for (int j{}; j < num_patches; ++j)
+    if (j != i && std::any_of(patches[j].begin(), patches[j].end(),
+                              [&] (const Vec3f &p) { return (p - center).Dot3(n) > EPSILON; }))
+      in_front.push_back(j);
+
+  renderFace(patches, center, n, u, v, -1, top_delta, row);
+  renderFace(patches, center, u, v, n, 0, side_delta, row);
+  renderFace(patches, center, -u, v, n, 0, side_delta, row);
+  renderFace(patches, center, v, u, n, 0, side_delta, row);
+  renderFace(patches, center, -v, u, n, 0, side_delta, row);
+}
+
+// ====================================================================
+
+void Hemicube::renderFace(const std::vector<Quad> &patches, const Vec3f &center,
+                          const Vec3f &forward, const Vec3f &right, const Vec3f &up, float y_min,
+                          const std::vector<float> &delta, std::vector<float> &row) {
+  const int height{static_cast<int>(resolution * (1 - y_min) / 2)};
+  std::fill(depth.begin(), depth.begin() + resolution * height, 0.f);
+  std::fill(item.begin(), item.begin() + resolution * height, -1);
+
+  for (const int j: in_front) {
+    // the corners in the face's frame:  (across, up, in front)
+    std::array<Vec3f, 4> q;
+    bool any_in_front{false};
+    for (int k{}; k < 4; ++k) {
+      const Vec3f p{patches[j][k] - center};
+      q[k] = {p.Dot3(right), p.Dot3(up), p.Dot3(forward)};
+      any_in_front |= q[k].z() > EPSILON;
+    }
+    if (!any_in_front) continue;
+
+    // clip the quad to just in front of the eye (Sutherland-Hodgman),
+    // which can add a corner
+    std::array<Vec3f, 5> poly;
+    int m{};
+    for (int k{}; k < 4; ++k) {
+      const Vec3f &a{q[k]}, &b{q[(k + 1) % 4]};
+      if (a.z() > EPSILON) poly[m++] = a;
+      if ((a.z() > EPSILON) != (b.z() > EPSILON))
+        poly[m++] = a + static_cast<float>((EPSILON - a.z()) / (b.z() - a.z())) * (b - a);
+    }
+
+    // project onto the face, in pixels, and draw it as a fan of triangles
+    std::array<float, 5> x, y, w;
+    for (int k{}; k < m; ++k) {
+      w[k] = 1 / poly[k].z();
+      x[k] = (poly[k].x() * w[k] + 1) * resolution / 2;
+      y[k] = (poly[k].y() * w[k] - y_min) * resolution / 2;
+    }
+    for (int k{1}; k + 1 < m; ++k)
+      rasterizeTriangle({x[0], x[k], x[k + 1]}, {y[0], y[k], y[k + 1]}, {w[0], w[k], w[k + 1]}, j, height);
+  }
+
+  // every pixel adds its share to the patch seen through it
+  for (int p{}; p < resolution * height; ++p)
+    if (item[p] >= 0)
+      row[item[p]] += delta[p];
+}
+
+// ====================================================================
+
+void Hemicube::rasterizeTriangle(const std::array<float, 3> &x, const std::array<float, 3> &y,
+                                 const std::array<float, 3> &w, int id, int height) {
+  // (twice the signed area:  dividing by it makes the barycentric
+  // coordinates come out right with either winding)
+  const float area{(x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0])};
+  if (!(std::abs(area) > 0)) return;
+
+  // the pixels whose centers might be covered, clamped to the face
+  auto first{[] (float a, int size) {
+    return static_cast<int>(std::clamp(std::ceil(a - .5f), 0.f, static_cast<float>(size))); }};
+  const int x0{first(std::min({x[0], x[1], x[2]}), resolution)};
+  const int x1{first(std::max({x[0], x[1], x[2]}) + 1, resolution)};
+  const int y0{first(std::min({y[0], y[1], y[2]}), height)};
+  const int y1{first(std::max({y[0], y[1], y[2]}) + 1, height)};
+
+  for (int py{y0}; py < y1; ++py) {
+    const float sy{py + .5f};
+    for (int px{x0}; px < x1; ++px) {
+      const float sx{px + .5f};
+      const float b0{((x[2] - x[1]) * (sy - y[1]) - (y[2] - y[1]) * (sx - x[1])) / area};
+      const float b1{((x[0] - x[2]) * (sy - y[2]) - (y[0] - y[2]) * (sx - x[2])) / area};
+      const float b2{1 - b0 - b1};
+      if (b0 < 0 || b1 < 0 || b2 < 0) continue;
+      // 1 / depth is linear across the screen; the closest is the largest
+      const float wz{b0 * w[0] + b1 * w[1] + b2 * w[2]};
+      const int p{py * resolution + px};
+      if (wz > depth[p]) {
+        depth[p] = wz;
+        item[p] = id;
+      }
+    }
+  }
+}
+
+// ====================================================================
@@ -0,0 +1,64 @@
+#ifndef _HEMICUBE_H_
+#define _HEMICUBE_H_
+
+#include <array>
+#include <vector>
+#include "vectors.h"
+
+// ====================================================================
+// ====================================================================
+// The hemicube form factor method (Cohen & Greenberg):  all of the
+// patches are rasterized, with a z-buffer, onto the five faces of a
+// half cube around a patch's centroid, and each pixel records the
+// index of the closest patch (an item buffer).  Each pixel subtends a
+// known, precomputed share of the form factor ("delta form factor"),
+// so adding up the pixels of each patch gives a whole row of the form
+// factor matrix in one pass, instead of a ray per pair of patches.
+//
+// Everything is rasterized on the CPU.  Each thread needs its own
+// Hemicube, for the buffers.
+
+class Hemicube {
+
+public:
+
+  // a patch, by its 4 corners
+  using Quad = std::array<Vec3f, 4>;
+
+  // ===========
+  // CONSTRUCTOR
+  // the top face is resolution x resolution pixels, the sides half that
+  explicit Hemicube(int resolution);
+
+  // the form factors from patch i (placed at center, facing normal) to
+  // every patch:  adds F_ij to row[j] (row has one entry per patch)
+  void computeRow(const std::vector<Quad> &patches, int i, const Vec3f &center, const Vec3f &normal,
+                  std::vector<float> &row);
+
+private:
+
+  // HELPER FUNCTIONS
+  // draws the in_front patches onto one face of the hemicube, looking along
+  // forward with the face spanning right x [-1,1], up x [y_min,1]
+  void renderFace(const std::vector<Quad> &patches, const Vec3f &center,
+                  const Vec3f &forward, const Vec3f &right, const Vec3f &up, float y_min,
+                  const std::vector<float> &delta, std::vector<float> &row);
+  void rasterizeTriangle(const std::array<float, 3> &x, const std::array<float, 3> &y,
+                         const std::array<float, 3> &w, int id, int height);
+
+  // REPRESENTATION
+  int resolution;
+  // the delta form factors of the pixels of the top face and of a side
+  std::vector<float> top_delta;
+  std::vector<float> side_delta;
+  // the patches that might be seen from the current patch
+  std::vector<int> in_front;
+  // z-buffer (of 1 / depth, closest is largest) and item buffer
+  std::vector<float> depth;
+  std::vector<int> item;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cmath>
+
+#include "hierarchical_radiosity.h"
+#include "mesh.h"
+#include "face.h"
+#include "material.h"
+#include "raytracer.h"
+#include "sampler.h"
+#include "parallel.h"
+#include "utils.h"
+
+// ====================================================================
+
+HierarchicalRadiosity::HierarchicalRadiosity(const Mesh &mesh, const RayTracer &r, float epsilon):
+  raytracer{r},
+  patch_element(mesh.numFaces())
+{
+  // the original quads were split into 4^levels patches each, and the
+  // rasterized primitive faces come after them, never split
+  const int levels{mesh.numSubdivisions()};
+  const int num_quads{mesh.numOriginalQuads()};
+  for (int i{}; i < num_quads; ++i)
+    roots.push_back(build(mesh, levels, i));
+  for (int i{num_quads << 2 * levels}; i < mesh.numFaces(); ++i)
+    roots.push_back(build(mesh, 0, i));
+
+  double emitted_power{};
+  for (const int p: roots)
+    emitted_power += elements[p].emitted.Length() * elements[p].area;
+  max_link_power = epsilon * emitted_power;
+
+  // (each receiving quadtree gets its own links, so they can be made in parallel)
+  const int num_roots = roots.size();
+  ParallelFor(num_roots, [&] (int i, int) {
+    for (const int q: roots)
+      if (q != roots[i]) link(roots[i], q);
+  });
+}
+
+// ====================================================================
+
+int HierarchicalRadiosity::build(const Mesh &mesh, int levels, int index) {
+  const int e = elements.size();
+  elements.emplace_back();
+  if (levels == 0) {
+    const Face &f{*mesh.getFace(index)};
+    Element &leaf{elements[e]};
+    leaf.corners = f.getVertices();
+    leaf.centroid = f.computeCentroid();
+    leaf.normal = f.computeNormal().Normalized();
+    leaf.area = f.getArea();
+    leaf.diffuse = f.getMaterial()->getDiffuseColor();
+    leaf.emitted = f.getMaterial()->getEmittedColor();
+    leaf.patch = f.getRadiosityPatchIndex();
+    leaf.radiance = leaf.emitted;
+    patch_element[leaf.patch] = e;
+    return e;
+  }
+
+  // the 4 faces made from this one are next to each other, on the next
+  // level down, starting at its corners in order (see Mesh::Subdivision)
+  std::array<int, 4> children;
+  for (int k{}; k < 4; ++k)
+    children[k] = build(mesh, levels - 1, 4 * index + k);
+  Element &parent{elements[e]};
+  parent.children = children;
+  parent.area = 0;
+  for (int k{}; k < 4; ++k) {
+    const Element &child{elements[children[k]]};
+    parent.corners[k] = child.corners[0];
+    parent.centroid += child.area * child.centroid;
+    parent.normal += child.area * child.normal;
+    parent.area += child.area;
+  }
+  parent.centroid /= parent.area;
+  parent.normal.Normalize();
+  const Element &child{elements[children[0]]};
+  parent.diffuse = child.diffuse;
+  parent.emitted = child.emitted;
+  parent.radiance = child.emitted;
+  return e;
+}
+
+std::size_t HierarchicalRadiosity::numLinks() const {
+  std::size_t count{};
+  for (const Element &e: elements)
+    count += e.links.size();
+  return count;
+}
+
+// ====================================================================
+
+// links p to gather from q, or their children instead
+void HierarchicalRadiosity::link(int p, int q) {
+  const int q_side{side(p, q)}, p_side{side(q, p)};
+  if (q_side < 0 || p_side < 0) return;
+  // (where either is partly behind the other, split to find the parts
+  // that can see each other, as far as possible)
+  if ((q_side == 0 || p_side == 0) && subdivide(p, q)) return;
+
+  const float f{estimateFormFactor(p, q)};
+  if (!(f > 0)) return;
+  if (const Link l{q, f}; !tooCoarse(p, l) || !subdivide(p, q))
+    elements[p].links.push_back(l);
+}
+
+// links the children of the larger of p and q instead, if it has any
+bool HierarchicalRadiosity::subdivide(int p, int q) {
+  const Element &ep{elements[p]}, &eq{elements[q]};
+  if (!ep.isLeaf() && (eq.isLeaf() || ep.area >= eq.area)) {
+    for (const int c: ep.children) link(c, q);
+    return true;
+  }
+  if (!eq.isLeaf()) {
+    for (const int c: eq.children) link(p, c);
+    return true;
+  }
+  return false;
+}
+
+// the BF refinement oracle:  does the link carry too much power?
+bool HierarchicalRadiosity::tooCoarse(int p, const Link &l) const {
+  return elements[l.source].radiance.Length() * l.form_factor * elements[p].area > max_link_power;
+}
+
+// is q in front of p's plane (1), behind it (-1) or across it (0)?
+int HierarchicalRadiosity::side(int p, int q) const {
+  const Element &ep{elements[p]};
+  bool in_front{false}, behind{false};
+  for (const Vertex *v: elements[q].corners) {
+    const float d{(v->get() - ep.centroid).Dot3(ep.normal)};
+    in_front |= d > EPSILON;
+    behind |= d < -EPSILON;
+  }
+  if (!in_front) return -1;
+  return behind? 0 : 1;
+}
+
+// F_pq, unoccluded, from a point on p to all of q:  exactly, by
+// Lambert's formula for a polygon, a sum over its edges of the angle
+// each subtends times the cosine of the plane through it and the point
+float HierarchicalRadiosity::pointFormFactor(const Vec3f &x, int p, int q) const {
+  std::array<Vec3f, 4> r;
+  for (int k{}; k < 4; ++k)
+    r[k] = (elements[q].corners[k]->get() - x).Normalized();
+  float sum{};
+  for (int k{}; k < 4; ++k) {
+    const Vec3f &a{r[k]}, &b{r[(k + 1) % 4]};
+    Vec3f n;
+    Vec3f::Cross3(n, a, b);
+    const float angle{std::acos(std::clamp(a.Dot3(b), -1.f, 1.f))};
+    sum += angle * n.Normalized().Dot3(elements[p].normal);
+  }
+  // (its sign depends on which way around q goes)
+  return std::abs(sum) / static_cast<float>(2 * M_PI);
+}
+
+// F_pq, averaged over a point in each quarter of p, each counted only
+// if a ray to it from a random point on q gets through
+float HierarchicalRadiosity::estimateFormFactor(int p, int q) const {
+  // (the same rays no matter which thread links them)
+  Sampler::Current().StartPixel(p, q, 0);
+  float sum{};
+  for (int k{}; k < 4; ++k) {
+    const float s{.5f * (k / 2)}, t{.5f * (k % 2)};
+    const Vec3f x{randPoint(elements[p].corners, s, t, .5f, .5f)};
+    const Vec3f y{randPoint(elements[q].corners)};
+    if (const float f{pointFormFactor(x, p, q)}; f > 0 && !raytracer.Occluded({y, x - y}, 1, true))
+      sum += f;
+  }
+  return sum / 4;
+}
+
+// ====================================================================
+
+void HierarchicalRadiosity::Iterate() {
+  // gather, everywhere at once from the last iteration's radiances
+  const int num_elements = elements.size();
+  ParallelFor(num_elements, [&] (int p, int) {
+    Vec3f gathered;
+    for (const Link &l: elements[p].links)
+      gathered += l.form_factor * elements[l.source].radiance;
+    elements[p].gathered = gathered;
+  });
+
+  // push-pull, and then refine for the new radiances
+  const int num_roots = roots.size();
+  ParallelFor(num_roots, [&] (int i, int) {
+    pushPull(roots[i], {});
+  });
+  ParallelFor(num_roots, [&] (int i, int) {
+    std::vector<int> stack{roots[i]};
+    while (!stack.empty()) {
+      const int p{stack.back()};
+      stack.pop_back();
+      std::vector<Link> links;
+      links.swap(elements[p].links);
+      for (const Link &l: links)
+        if (!tooCoarse(p, l) || !subdivide(p, l.source))
+          elements[p].links.push_back(l);
+      if (!elements[p].isLeaf())
+        stack.insert(stack.end(), elements[p].children.begin(), elements[p].children.end());
+    }
+  });
+}
+
+// passes what p and its parents gathered down to its patches, and
+// returns its area weighted average radiance
+Vec3f HierarchicalRadiosity::pushPull(int p, const Vec3f &down) {
+  Element &e{elements[p]};
+  const Vec3f incoming{down + e.gathered};
+  if (e.isLeaf()) {
+    e.irradiance = incoming;
+    e.radiance = e.emitted + e.diffuse * incoming;
+  } else {
+    Vec3f sum;
+    for (const int c: e.children)
+      sum += elements[c].area * pushPull(c, incoming);
+    e.radiance = sum / e.area;
+  }
+  return e.radiance;
+}
+
+// ====================================================================
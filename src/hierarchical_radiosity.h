@@ -0,0 +1,107 @@
+#ifndef _HIERARCHICAL_RADIOSITY_H_
+#define _HIERARCHICAL_RADIOSITY_H_
+
+#include <array>
+#include <cstddef>
+#include <vector>
+#include "vectors.h"
+
+class Mesh;
+class Vertex;
+class RayTracer;
+
+// ====================================================================
+// ====================================================================
+// Hierarchical radiosity (Hanrahan, Salzman & Aupperle).  Rather than
+// a form factor between every pair of patches, light moves along links
+// between elements of a quadtree over each original quad, each link at
+// the coarsest level that carries little enough power ("BF
+// refinement":  the radiance of the source times the estimated form
+// factor times the area of the receiver).  The quadtree is the one
+// Mesh::Subdivision builds, with the patches as its leaves, so the
+// subdivision only sets the finest level, and the number of links
+// grows about linearly with the number of patches instead of
+// quadratically.
+//
+// Each Iterate gathers over all of the links at once (Jacobi), pushes
+// what each element gathered down to its patches and pulls their area
+// weighted average radiance back up, and then refines the links that
+// the new radiances made too coarse.
+
+class HierarchicalRadiosity {
+
+public:
+
+  // ===========
+  // CONSTRUCTOR
+  // links every pair of original quads (and rasterized primitive
+  // faces) that face each other, refining as needed for the emitters;
+  // a link may carry at most epsilon times the emitted power
+  HierarchicalRadiosity(const Mesh &mesh, const RayTracer &raytracer, float epsilon);
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] int numElements() const { return static_cast<int>(elements.size()); }
+  [[nodiscard]] std::size_t numLinks() const;
+  // by radiosity patch index
+  [[nodiscard]] const Vec3f& getRadiance(int patch) const { return elements[patch_element[patch]].radiance; }
+  // the sum of F B over all of the links into the patch and its parents
+  [[nodiscard]] const Vec3f& getIrradiance(int patch) const { return elements[patch_element[patch]].irradiance; }
+
+  // =========
+  // MODIFIERS
+  void Iterate();
+
+private:
+
+  // receiving F B of the source element (with F for the part of it
+  // that's visible)
+  struct Link {
+    int source;
+    float form_factor;
+  };
+
+  struct Element {
+    [[nodiscard]] bool isLeaf() const { return children[0] < 0; }
+    std::array<Vertex*, 4> corners;
+    Vec3f centroid;
+    Vec3f normal;
+    float area;
+    Vec3f diffuse;
+    Vec3f emitted;
+    // the quarters, one per corner, or -1 for a patch
+    std::array<int, 4> children{-1, -1, -1, -1};
+    // the patch's index in Radiosity (for a leaf)
+    int patch{-1};
+    std::vector<Link> links;
+    // F B summed over the element's own links
+    Vec3f gathered;
+    // and with those of its parents (for a leaf)
+    Vec3f irradiance;
+    Vec3f radiance;
+  };
+
+  // HELPER FUNCTIONS
+  int build(const Mesh &mesh, int levels, int index);
+  void link(int p, int q);
+  bool subdivide(int p, int q);
+  [[nodiscard]] bool tooCoarse(int p, const Link &l) const;
+  [[nodiscard]] int side(int p, int q) const;
+  [[nodiscard]] float pointFormFactor(const Vec3f &x, int p, int q) const;
+  [[nodiscard]] float estimateFormFactor(int p, int q) const;
+  Vec3f pushPull(int p, const Vec3f &down);
+
+  // REPRESENTATION
+  const RayTracer &raytracer;
+  std::vector<Element> elements;
+  // the tops of the quadtrees
+  std::vector<int> roots;
+  std::vector<int> patch_element;
+  // the most power a link may carry
+  float max_link_power;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
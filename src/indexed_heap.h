@@ -0,0 +1,82 @@
+#ifndef _INDEXED_HEAP_H_
+#define _INDEXED_HEAP_H_
+
+#include <cassert>
+#include <utility>
+#include <vector>
+
+// ====================================================================
+// ====================================================================
+// A binary max-heap of the items 0..n-1 by a key each, which also
+// tracks where each item is in the heap, so a key can be changed in
+// place in O(log n) (and in O(1) when it doesn't pass its parent, as
+// with small increases).
+
+class IndexedMaxHeap {
+
+public:
+
+  // ===========
+  // CONSTRUCTOR
+  IndexedMaxHeap() = default;
+  explicit IndexedMaxHeap(std::vector<float> k): keys{std::move(k)}, heap(keys.size()), position(keys.size()) {
+    const int n = keys.size();
+    for (int i{}; i < n; ++i)
+      heap[i] = position[i] = i;
+    for (int i{n / 2 - 1}; i >= 0; --i)
+      siftDown(i);
+  }
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] bool empty() const { return heap.empty(); }
+  // the item with the largest key
+  [[nodiscard]] int top() const {
+    assert (!empty());
+    return heap[0]; }
+  [[nodiscard]] float key(int i) const { return keys[i]; }
+
+  // =========
+  // MODIFIERS
+  void update(int i, float key) {
+    assert (i >= 0 && i < static_cast<int>(keys.size()));
+    const float old{keys[i]};
+    keys[i] = key;
+    if (key > old) siftUp(position[i]);
+    else if (key < old) siftDown(position[i]);
+  }
+
+private:
+
+  void swap(int a, int b) {
+    std::swap(heap[a], heap[b]);
+    position[heap[a]] = a;
+    position[heap[b]] = b;
+  }
+  void siftUp(int p) {
+    while (p > 0 && keys[heap[(p - 1) / 2]] < keys[heap[p]]) {
+      swap(p, (p - 1) / 2);
+      p = (p - 1) / 2;
+    }
+  }
+  void siftDown(int p) {
+    const int n = heap.size();
+    for (int child{2 * p + 1}; child < n; p = child, child = 2 * p + 1) {
+      if (child + 1 < n && keys[heap[child]] < keys[heap[child + 1]]) ++child;
+      if (!(keys[heap[p]] < keys[heap[child]])) return;
+      swap(p, child);
+    }
+  }
+
+  // REPRESENTATION
+  // by item
+  std::vector<float> keys;
+  // the items in heap order, and where each item is in it
+  std::vector<int> heap;
+  std::vector<int> position;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+#include "irradiance_cache.h"
+#include "argparser.h"
+
+// ====================================================================
+
+IrradianceCache::IrradianceCache(const BoundingBox &bbox, float e, float min_r, float max_r) :
+  error{e},
+  min_radius{min_r},
+  max_radius{max_r},
+  root{},
+  num_records{}
+{
+  // a cube around the scene, a little larger so nothing is on its faces
+  Vec3f center;
+  bbox.getCenter(center);
+  root = new Node{center, 0.51f * static_cast<float>(bbox.maxDim())};
+}
+
+IrradianceCache::~IrradianceCache() {
+  delete root;
+}
+
+std::size_t IrradianceCache::numRecords() const {
+  std::shared_lock lock{mutex};
+  return num_records;
+}
+
+// ====================================================================
+// LOOKUP
+
+bool IrradianceCache::Lookup(const Vec3f &point, const Vec3f &normal, Vec3f &irradiance) const {
+  Vec3f sum;
+  float sum_weight{};
+  {
+    std::shared_lock lock{mutex};
+    lookup(*root, point, normal, sum, sum_weight);
+  }
+  if (sum_weight <= 0) return false;
+  irradiance = sum / sum_weight;
+  irradiance = {std::max(irradiance.r(), 0.f), std::max(irradiance.g(), 0.f), std::max(irradiance.b(), 0.f)};
+  return true;
+}
+
+void IrradianceCache::lookup(const Node &node, const Vec3f &point, const Vec3f &normal,
+                             Vec3f &sum, float &sum_weight) const {
+  // (the records here are valid no farther than half_size outside it)
+  for (int axis{}; axis < 3; ++axis)
+    if (std::abs(point[axis] - node.center[axis]) > 2 * node.half_size) return;
+
+  for (const Record &r: node.records) {
+    // Ward's weight, which falls off with the distance relative to the
+    // record's radius and with the angle between the normals, and is
+    // at least 1 / error where the record is valid
+    const Vec3f offset{point - r.position};
+    const float distance{offset.Length()};
+    const float weight{1 / std::max(distance / r.radius + std::sqrt(std::max(0.f, 1 - normal.Dot3(r.normal))),
+                                    1e-6f)};
+    if (weight <= 1 / error) continue;
+    // (nor from records in front of the point, which see what it can't)
+    if (offset.Dot3(normal + r.normal) < -0.1f * r.radius) continue;
+
+    Vec3f turn;
+    Vec3f::Cross3(turn, r.normal, normal);
+    const Vec3f extrapolated{
+      r.irradiance.r() + r.rotational_gradient[0].Dot3(turn) + r.translational_gradient[0].Dot3(offset),
+      r.irradiance.g() + r.rotational_gradient[1].Dot3(turn) + r.translational_gradient[1].Dot3(offset),
+      r.irradiance.b() + r.rotational_gradient[2].Dot3(turn) + r.translational_gradient[2].Dot3(offset)};
+    sum += weight * extrapolated;
+    sum_weight += weight;
+  }
+
+  for (const Node *child: node.children)
+    if (child != nullptr)
+      lookup(*child, point, normal, sum, sum_weight);
+}
+
+// ====================================================================
+// NEW RECORDS
+
+Vec3f IrradianceCache::AddRecord(const Vec3f &point, const Vec3f &normal, int num_samples,
+                                 const std::function<Vec3f(const Vec3f&, float&)> &radiance) {
+  // M rings of theta by N = pi M sectors of phi, each of the same
+  // (cosine weighted) solid angle
+  const int M{std::max(2, static_cast<int>(std::lround(std::sqrt(num_samples / M_PI))))};
+  const int N{std::max(3, static_cast<int>(std::lround(num_samples / static_cast<float>(M))))};
+
+  // a frame around the normal
+  Vec3f u, v;
+  Vec3f::Cross3(u, std::abs(normal.x()) < 0.9f? Vec3f{1,0,0} : Vec3f{0,1,0}, normal);
+  u.Normalize();
+  Vec3f::Cross3(v, normal, u);
+  auto around{[&] (float phi) { return std::cos(phi) * u + std::sin(phi) * v; }};
+
+  std::vector<Vec3f> L(M * N);
+  std::vector<float> R(M * N);
+  std::vector<float> tan_theta(M * N);
+  Vec3f sum;
+  float sum_inverse_distance{};
+  for (int j{}; j < M; ++j)
+    for (int k{}; k < N; ++k) {
+      const float sin_theta_sqr = (j + ArgParser::rand()) / M;
+      const float phi = 2 * M_PI * (k + ArgParser::rand()) / N;
+      const float sin_theta{std::sqrt(sin_theta_sqr)}, cos_theta{std::sqrt(1 - sin_theta_sqr)};
+      const Vec3f direction{sin_theta * around(phi) + cos_theta * normal};
+      float distance{std::numeric_limits<float>::infinity()};
+      L[j * N + k] = radiance(direction, distance);
+      R[j * N + k] = distance;
+      tan_theta[j * N + k] = sin_theta / std::max(cos_theta, 1e-3f);
+      sum += L[j * N + k];
+      sum_inverse_distance += 1 / distance;
+    }
+
+  Record record{};
+  record.position = point;
+  record.normal = normal;
+  record.irradiance = static_cast<float>(M_PI) / (M * N) * sum;
+
+  // the gradients (Ward & Heckbert), from how the radiance changes
+  // across the boundaries between the cells
+  auto theta_boundary{[&] (int j) { return std::asin(std::sqrt(static_cast<float>(j) / M)); }};
+  for (int k{}; k < N; ++k) {
+    const float phi_center = 2 * M_PI * (k + .5f) / N;
+    const float phi_boundary = 2 * M_PI * k / N;
+    const Vec3f u_k{around(phi_center)};
+    const Vec3f v_k{around(phi_center + M_PI / 2)};
+    const Vec3f v_boundary{around(phi_boundary + M_PI / 2)};
+    const int previous_k{(k + N - 1) % N};
+    Vec3f rotational, across_theta, across_phi;
+    for (int j{}; j < M; ++j) {
+      rotational -= tan_theta[j * N + k] * L[j * N + k];
+      if (j > 0) {
+        const float theta{theta_boundary(j)};
+        const float c{std::cos(theta)};
+        across_theta += std::sin(theta) * c * c / std::min(R[j * N + k], R[(j - 1) * N + k]) *
+          (L[j * N + k] - L[(j - 1) * N + k]);
+      }
+      const float theta_center{std::asin(std::sqrt((j + .5f) / M))};
+      across_phi += (std::cos(theta_boundary(j)) - std::cos(theta_boundary(j + 1))) /
+        (std::sin(theta_center) * std::min(R[j * N + k], R[j * N + previous_k])) *
+        (L[j * N + k] - L[j * N + previous_k]);
+    }
+    for (int c{}; c < 3; ++c) {
+      record.rotational_gradient[c] += static_cast<float>(M_PI) / (M * N) * rotational[c] * v_k;
+      record.translational_gradient[c] += 2 * static_cast<float>(M_PI) / N * across_theta[c] * u_k +
+        across_phi[c] * v_boundary;
+    }
+  }
+
+  // the harmonic mean distance, clamped, and no larger than the
+  // distance over which the translational gradient would change the
+  // irradiance by as much as it is
+  float radius{sum_inverse_distance > 0? M * N / sum_inverse_distance : max_radius};
+  for (int c{}; c < 3; ++c) {
+    const float change{record.translational_gradient[c].Length()};
+    if (change > 0 && record.irradiance[c] > 0)
+      radius = std::min(radius, record.irradiance[c] / change);
+  }
+  record.radius = std::clamp(radius, min_radius, max_radius);
+
+  insert(record);
+  return record.irradiance;
+}
+
+void IrradianceCache::insert(const Record &record) {
+  std::unique_lock lock{mutex};
+  // down to the smallest cube that's still as big as where it's valid
+  const float valid{error * record.radius};
+  Node *node{root};
+  while (node->half_size / 2 >= valid) {
+    int octant{};
+    for (int axis{}; axis < 3; ++axis)
+      if (record.position[axis] > node->center[axis]) octant |= 1 << axis;
+    Node *&child{node->children[octant]};
+    if (child == nullptr) {
+      const float h{node->half_size / 2};
+      child = new Node{{node->center.x() + (octant & 1? h : -h),
+                        node->center.y() + (octant & 2? h : -h),
+                        node->center.z() + (octant & 4? h : -h)}, h};
+    }
+    node = child;
+  }
+  node->records.push_back(record);
+  ++num_records;
+}
+
+// ====================================================================
@@ -0,0 +1,100 @@
+#ifndef _IRRADIANCE_CACHE_H_
+#define _IRRADIANCE_CACHE_H_
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <shared_mutex>
+#include <vector>
+#include "boundingbox.h"
+
+// ====================================================================
+// ====================================================================
+// Irradiance caching (Ward, Rubinstein & Clear; with the gradients of
+// Ward & Heckbert).  Indirect diffuse light changes slowly over a
+// surface, so rather than sampling the hemisphere at every hit, it's
+// sampled at a sparse set of records, and interpolated from those
+// nearby wherever they're close enough.  A record is trusted out to a
+// fraction (the error, Ward's a) of the harmonic mean distance to
+// what its samples hit, so the records crowd together near corners
+// and contacts and spread out over open surfaces.  Each also keeps how
+// its irradiance changes as the normal turns (rotational gradient) and
+// as the point moves (translational gradient), for smoother
+// interpolation.
+//
+// The records are kept in an octree, each at the level that's about
+// as big as the region it's valid in.  Lookups and new records may
+// come from any number of threads at once.
+
+class IrradianceCache {
+
+public:
+
+  // ========================
+  // CONSTRUCTOR & DESTRUCTOR
+  // for the scene within bbox, with the radius of each record clamped
+  // to [min_radius, max_radius]
+  IrradianceCache(const BoundingBox &bbox, float error, float min_radius, float max_radius);
+  ~IrradianceCache();
+  IrradianceCache(const IrradianceCache&) = delete;
+  IrradianceCache& operator=(const IrradianceCache&) = delete;
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] std::size_t numRecords() const;
+  // the irradiance at the point, interpolated from the records that
+  // are valid there, or false if there aren't any
+  [[nodiscard]] bool Lookup(const Vec3f &point, const Vec3f &normal, Vec3f &irradiance) const;
+
+  // =========
+  // MODIFIERS
+  // Samples the hemisphere around the normal with about num_samples
+  // stratified, cosine weighted directions, and adds a record there.
+  // radiance(direction, distance) returns the radiance arriving from
+  // the direction and the distance to where it left (infinite if
+  // nothing was hit).  Returns the irradiance.
+  Vec3f AddRecord(const Vec3f &point, const Vec3f &normal, int num_samples,
+                  const std::function<Vec3f(const Vec3f &direction, float &distance)> &radiance);
+
+private:
+
+  struct Record {
+    Vec3f position;
+    Vec3f normal;
+    Vec3f irradiance;
+    float radius;
+    // (one of each for red, green and blue)
+    std::array<Vec3f, 3> rotational_gradient;
+    std::array<Vec3f, 3> translational_gradient;
+  };
+
+  // a cube of the octree, with the records centered in it that are
+  // valid no farther than half_size from their centers, and not much
+  // less far
+  struct Node {
+    Node(const Vec3f &c, float h) : center{c}, half_size{h} {}
+    ~Node() { for (Node *child: children) delete child; }
+    Vec3f center;
+    float half_size;
+    std::vector<Record> records;
+    std::array<Node*, 8> children{};
+  };
+
+  // HELPER FUNCTIONS
+  void lookup(const Node &node, const Vec3f &point, const Vec3f &normal, Vec3f &sum, float &sum_weight) const;
+  void insert(const Record &record);
+
+  // REPRESENTATION
+  float error;
+  float min_radius;
+  float max_radius;
+  Node *root;
+  std::size_t num_records;
+  // (shared for lookups, exclusive to add)
+  mutable std::shared_mutex mutex;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
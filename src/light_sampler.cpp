@@ -0,0 +1,64 @@
+#include "light_sampler.h"
+#include "face.h"
+#include "material.h"
+#include "sampler.h"
+
+// ==================================================================
+
+LightSampler::LightSampler(const std::vector<Face*> &faces) {
+  const int n = faces.size();
+  lights.reserve(n);
+  std::vector<double> power(n);
+  double total_power{};
+  for (int i{}; i < n; ++i) {
+    const Face &f{*faces[i]};
+    const Vec3f emitted{f.getMaterial()->getEmittedColor()};
+    lights.push_back({&f, f.computeNormal(), emitted, f.getArea(), 0});
+    power[i] = (emitted.r() + emitted.g() + emitted.b()) / 3 * lights[i].area;
+    total_power += power[i];
+  }
+  if (n == 0) return;
+  // (if there's no power to speak of, pick the lights uniformly)
+  if (!(total_power > 0)) {
+    power.assign(n, 1);
+    total_power = n;
+  }
+
+  // Vose's method:  scale the probabilities so they average 1, then
+  // repeatedly fill up an underfull bin with the excess of an overfull one
+  threshold.assign(n, 1);
+  alias.resize(n);
+  std::vector<double> scaled(n);
+  std::vector<int> small, large;
+  for (int i{}; i < n; ++i) {
+    lights[i].pdf = power[i] / total_power;
+    alias[i] = i;
+    scaled[i] = power[i] / total_power * n;
+    (scaled[i] < 1? small : large).push_back(i);
+  }
+  while (!small.empty() && !large.empty()) {
+    const int s{small.back()}, l{large.back()};
+    small.pop_back();
+    threshold[s] = scaled[s];
+    alias[s] = l;
+    scaled[l] -= 1 - scaled[s];
+    if (scaled[l] < 1) {
+      large.pop_back();
+      small.push_back(l);
+    }
+  }
+  // (whatever is left over is full, up to roundoff)
+}
+
+// ==================================================================
+
+const LightSampler::Light& LightSampler::Pick() const {
+  assert (!lights.empty());
+  if (lights.size() == 1) return lights[0];
+  // one random number picks both the bin and the side of it
+  const double u{Sampler::Current().Get1D() * lights.size()};
+  const int i{static_cast<int>(u)};
+  return lights[u - i < threshold[i]? i : alias[i]];
+}
+
+// ==================================================================
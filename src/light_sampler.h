@@ -0,0 +1,53 @@
+#ifndef _LIGHT_SAMPLER_H_
+#define _LIGHT_SAMPLER_H_
+
+#include <vector>
+#include "vectors.h"
+
+class Face;
+
+// ==================================================================
+// Picks one of the scene's light sources at random, with probability
+// proportional to the power it emits (emitted color x area), using an
+// alias table (Walker / Vose) so a pick costs O(1) however many
+// lights there are.  Dividing a light's contribution by its pdf keeps
+// the estimate of the direct illumination from all lights unbiased.
+
+class LightSampler {
+ public:
+
+  // what shading needs to know about a light, cached so it isn't
+  // recomputed from the half-edge mesh for every light sample
+  struct Light {
+    const Face *face;
+    Vec3f normal;
+    Vec3f emitted;
+    float area;
+    // the probability that Pick chooses this light
+    float pdf;
+  };
+
+  // ===========
+  // CONSTRUCTOR
+  explicit LightSampler(const std::vector<Face*> &lights);
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] bool empty() const { return lights.empty(); }
+  [[nodiscard]] const std::vector<Light>& getLights() const { return lights; }
+
+  // a random light, drawn with its pdf from the calling thread's
+  // sampler.  (With a single light nothing is drawn.)
+  [[nodiscard]] const Light& Pick() const;
+
+ private:
+
+  // REPRESENTATION
+  std::vector<Light> lights;
+  // the alias table:  bin i is light i with probability threshold[i],
+  // and light alias[i] otherwise
+  std::vector<float> threshold;
+  std::vector<int> alias;
+};
+
+#endif
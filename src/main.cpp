@@ -1,11 +1,17 @@
+#include <chrono>
+#include <iostream>
 #include "argparser.h"
 #include "meshdata.h"
+#include "raytracer.h"
+#include "photon_mapping.h"
 
 
 // =========================================================
 // OS specific rendering for OpenGL and Apple Metal
+// (or none at all in the headless build)
 // =========================================================
-#if __APPLE__
+#if HEADLESS
+#elif __APPLE__
 extern "C" {
 int NSApplicationMain(int argc, const char * argv[]);
 }
@@ -23,13 +29,30 @@ int main(int argc, const char * argv[]) {
 
   
   // parse the command line arguments and initialize the MeshData
+  using namespace std::chrono;
+  auto tStart{steady_clock::now()};
   MeshData mymesh_data;
   mesh_data = &mymesh_data;
   ArgParser args(argc, argv, mesh_data);
 
 
+  // without a window, render straight to the output file and quit
+  if (args.headless) {
+    auto p{std::cout.precision(2)};
+    (std::cout << "Scene loaded in " << std::fixed
+      << duration_cast<duration<float>>(steady_clock::now() - tStart).count() << " seconds."
+      << std::endl << std::defaultfloat).precision(p);
+    // (progressive photon mapping traces its own, pass by pass)
+    if (mesh_data->gather_indirect && mesh_data->progressive_photon_passes == 0)
+      args.photon_mapping->TracePhotons();
+    return args.raytracer->renderToFile(args.output_file)? 0 : 1;
+  }
+
+
   // launch the OS specific renderer
-#if __APPLE__
+#if HEADLESS
+  // (unreachable, this build is always headless)
+#elif __APPLE__
   return NSApplicationMain(argc, argv);
 #else
   OpenGLRenderer opengl_renderer(mesh_data,&args);
@@ -45,6 +45,7 @@ Mesh::~Mesh() {
   for (auto p: materials) delete p;
   for (auto p: vertices) delete p;
   delete bbox;
+  delete camera;
 }
 
 // =======================================================================
@@ -350,4 +351,5 @@ void Mesh::Subdivision() {
     assert (getEdge(d,da) != nullptr);
     assert (getEdge(da,a) != nullptr);
   }
+  ++num_subdivisions;
 }
@@ -28,7 +28,7 @@ public:
 
   // ===============================
   // CONSTRUCTOR & DESTRUCTOR & LOAD
-  Mesh(): bbox{} {}
+  Mesh(): camera{}, bbox{}, num_subdivisions{} {}
   virtual ~Mesh();
   void Load(ArgParser *_args);
 
@@ -94,7 +94,12 @@ public:
 
   // ===============
   // OTHER FUNCTIONS
+  // Splits every subdivided quad into 4, one at each of its corners (in
+  // order), and keeps the 4 next to each other:  after k subdivisions,
+  // face i (of the subdivided quads) is in original quad i / 4^k, and
+  // its parent was face i / 4 of the subdivision before.
   void Subdivision();
+  [[nodiscard]] int numSubdivisions() const { return num_subdivisions; }
 
 private:
 
@@ -133,6 +138,8 @@ private:
   std::vector<Face*> rasterized_primitive_faces;
   // the quads from the .obj file after subdivision
   std::vector<Face*> subdivided_quads;
+  // how many times they've been subdivided
+  int num_subdivisions;
 };
 
 // ======================================================================
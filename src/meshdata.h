@@ -24,11 +24,27 @@ enum RENDER_MODE { RENDER_MATERIALS, RENDER_RADIANCE, RENDER_FORM_FACTORS,
 		   RENDER_LIGHTS, RENDER_UNDISTRIBUTED, RENDER_ABSORBED };
 
 
+// RADIOSITY SOLVERS:  progressive shooting, or gathering for all of
+// the patches each sweep
+enum RADIOSITY_SOLVER { RADIOSITY_SHOOTING, RADIOSITY_JACOBI, RADIOSITY_GAUSS_SEIDEL };
+
+
+// FORM FACTOR ENGINES FOR RADIOSITY
+enum FORM_FACTOR_METHOD { FORM_FACTORS_RAYCAST, FORM_FACTORS_HEMICUBE };
+
+
+// PHOTON MAP STRUCTURES:  a balanced kd-tree, or a hashed uniform
+// grid, which is quicker to build
+enum PHOTON_MAP { PHOTON_MAP_KDTREE, PHOTON_MAP_HASH_GRID };
+
+
 typedef struct MeshData {
 
   // REPRESENTATION
   int width;
   int height;
+  // worker threads for rendering to file (0 = one per hardware thread)
+  int num_threads;
 
   // animation control
   bool raytracing_animation;
@@ -38,18 +54,40 @@ typedef struct MeshData {
   enum RENDER_MODE render_mode;
   bool interpolate;
   bool wireframe;
+  enum RADIOSITY_SOLVER radiosity_solver;
+  enum FORM_FACTOR_METHOD form_factor_method;
   int num_form_factor_samples;
+  int hemicube_resolution;
+  // store only the nonzero form factors, even for few patches (with
+  // the ray cast form factors, that integrates every pair twice)
+  bool sparse_form_factors;
+  // solve with links between levels of the subdivision instead of
+  // the form factors, each carrying at most epsilon of the emitted power
+  bool hierarchical_radiosity;
+  float hierarchical_epsilon;
   int sphere_horiz;
   int sphere_vert;
   int cylinder_ring_rasterization;
 
   // RAYTRACING PARAMETERS
+  // (negative: unlimited, paths are ended by Russian roulette)
   int num_bounces;
   int num_shadow_samples;
   int num_antialias_samples;
   int num_glossy_samples;
   float3 ambient_light;
   bool intersect_backfacing;
+  bool sample_all_lights;
+  bool russian_roulette;
+  int russian_roulette_depth;
+  // the diffuse indirect light seen from the camera, interpolated
+  // between cached records of irradiance_cache_samples hemisphere
+  // samples each, trusted as far as the error (Ward's a) allows; and
+  // the pixel spacing of a pass that seeds it first (0 = none)
+  bool irradiance_cache;
+  float irradiance_cache_error;
+  int irradiance_cache_samples;
+  int irradiance_cache_prepass;
   int raytracing_divs_x;
   int raytracing_divs_y;
   int raytracing_x;
@@ -58,10 +96,29 @@ typedef struct MeshData {
   // PHOTON MAPPING PARAMETERS
   int num_photons_to_shoot;
   int num_photons_to_collect;
+  // the caustic map (0 = none, the caustic photons are in with the
+  // rest), shot only toward the mirrors
+  int num_caustic_photons_to_shoot;
+  int num_caustic_photons_to_collect;
+  enum PHOTON_MAP photon_map;
+  // the farthest a gather looks for them (0 = as far as it takes with
+  // the kd-tree, or for the grid, about as far as k would be if the
+  // photons were spread evenly)
+  float photon_gather_radius;
+  // progressive photon mapping:  the photon passes (0 = off), each of
+  // num_photons_to_shoot, and the fraction of the photons each keeps
+  int progressive_photon_passes;
+  float progressive_alpha;
   bool render_photons;
   bool render_photon_directions;
   bool render_kdtree;
   bool gather_indirect;
+  // final gather:  from the camera, the rays over the hemisphere whose
+  // hits gather the photons (0 = gather them at the camera hit), and
+  // every how many photons the irradiance is precomputed at for them
+  // (Christensen; 0 = a full gather at each)
+  int final_gather_samples;
+  int precompute_irradiance;
 
   bool bounding_box_frame;
   
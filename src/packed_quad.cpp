@@ -0,0 +1,92 @@
+#include "packed_quad.h"
+#include "face.h"
+#include "ray.h"
+#include "hit.h"
+#include "utils.h"
+
+// ==================================================================
+
+PackedQuad::PackedQuad(const Face &f) {
+  const auto vs{f.getVertices()};
+  a = vs[0]->get();
+  ab = vs[1]->get() - a;
+  ac = vs[2]->get() - a;
+  ad = vs[3]->get() - a;
+  normal = f.computeNormal();
+  d = normal.Dot3(a);
+  for (int i{}; i < 4; ++i) {
+    s[i] = vs[i]->get_s();
+    t[i] = vs[i]->get_t();
+  }
+  material = f.getMaterial();
+}
+
+// ==================================================================
+
+bool PackedQuad::intersect(const Ray &r, Hit &h, bool intersect_backfacing) const {
+  const float t_hit = plane_parameter(r,intersect_backfacing);
+  if (!(t_hit > EPSILON && t_hit < h.getT())) return 0;
+
+  const Vec3f to_origin{r.getOrigin() - a};
+  float beta, gamma;
+  // the corners of the subtriangle that was hit
+  int i1, i2;
+  if (barycentric(r,to_origin,ab,ac,beta,gamma)) {
+    i1 = 1; i2 = 2;
+  } else if (barycentric(r,to_origin,ac,ad,beta,gamma)) {
+    i1 = 2; i2 = 3;
+  } else {
+    return 0;
+  }
+
+  h.set(t_hit,material,normal);
+  // interpolate the texture coordinates
+  float alpha = 1 - beta - gamma;
+  h.setTextureCoords(alpha * s[0] + beta * s[i1] + gamma * s[i2],
+                     alpha * t[0] + beta * t[i1] + gamma * t[i2]);
+  assert (h.getT() >= EPSILON);
+  return 1;
+}
+
+bool PackedQuad::occludes(const Ray &r, float t_max, bool intersect_backfacing) const {
+  const float t_hit = plane_parameter(r,intersect_backfacing);
+  if (!(t_hit > EPSILON && t_hit < t_max)) return 0;
+  const Vec3f to_origin{r.getOrigin() - a};
+  float beta, gamma;
+  return barycentric(r,to_origin,ab,ac,beta,gamma) || barycentric(r,to_origin,ac,ad,beta,gamma);
+}
+
+// ==================================================================
+
+float PackedQuad::plane_parameter(const Ray &r, bool intersect_backfacing) const {
+  // origin . normal + t * direction . normal = d
+  const float denom = r.getDirection().Dot3(normal);
+  if (denom == 0) return 0;  // parallel to plane
+  if (!intersect_backfacing && denom >= 0) return 0;  // hit the backside
+  return (d - r.getOrigin().Dot3(normal)) / denom;
+}
+
+// Moller-Trumbore:  the barycentric coordinates of the ray's hit on the
+// triangle (a, a+e1, a+e2), as the weights of its 2nd and 3rd corners.
+// to_origin is the ray origin relative to a.
+bool PackedQuad::barycentric(const Ray &r, const Vec3f &to_origin, const Vec3f &e1, const Vec3f &e2,
+                             float &beta, float &gamma) {
+  const Vec3f &dir = r.getDirection();
+  Vec3f p;
+  Vec3f::Cross3(p,dir,e2);
+  const float det = e1.Dot3(p);
+  if (fabs(det) <= 0.000001) return 0;
+  const float inv_det = 1 / det;
+
+  beta = to_origin.Dot3(p) * inv_det;
+  if (beta < -0.00001 || beta > 1.00001) return 0;
+  Vec3f q;
+  Vec3f::Cross3(q,to_origin,e1);
+  gamma = dir.Dot3(q) * inv_det;
+
+  // is the point inside the triangle?
+  return gamma >= -0.00001 && gamma <= 1.00001 &&
+    beta + gamma <= 1.00001;
+}
+
+// ==================================================================
@@ -0,0 +1,51 @@
+#ifndef _PACKED_QUAD_H_
+#define _PACKED_QUAD_H_
+
+#include "vectors.h"
+
+class Face;
+class Material;
+class Ray;
+class Hit;
+
+// ==================================================================
+// Everything needed to intersect a ray with a quad, copied out of the
+// half-edge mesh when the scene is loaded.  Intersecting a Face
+// directly walks its edges to find the vertices and recomputes its
+// normal for every ray; these records are stored contiguously in the
+// BVH leaves instead.  (The Face stays the representation for editing
+// and radiosity.)
+
+class PackedQuad {
+ public:
+
+  // ===========
+  // CONSTRUCTOR
+  PackedQuad() = default;
+  explicit PackedQuad(const Face &f);
+
+  // same as Face::intersect / Face::occludes used to be:  t comes from
+  // the (average) plane of the quad, and the two triangles (a,b,c) and
+  // (a,c,d) decide whether the hit is inside
+  bool intersect(const Ray &r, Hit &h, bool intersect_backfacing) const;
+  [[nodiscard]] bool occludes(const Ray &r, float t_max, bool intersect_backfacing) const;
+
+ private:
+
+  // HELPER FUNCTIONS
+  float plane_parameter(const Ray &r, bool intersect_backfacing) const;
+  static bool barycentric(const Ray &r, const Vec3f &to_origin, const Vec3f &e1, const Vec3f &e2,
+                          float &beta, float &gamma);
+
+  // REPRESENTATION
+  // the first corner, and the edges from it to the other three
+  Vec3f a, ab, ac, ad;
+  // the plane:  normal . p == d
+  Vec3f normal;
+  float d;
+  // texture coordinates of the corners
+  float s[4], t[4];
+  Material *material;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "parallel.h"
+#include "argparser.h"
+#include "meshdata.h"
+
+// ====================================================================
+
+int NumWorkerThreads() {
+  if (GLOBAL_args && GLOBAL_args->mesh_data->num_threads > 0)
+    return GLOBAL_args->mesh_data->num_threads;
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
+// ====================================================================
+// The remaining share of one worker, [begin, end), packed into a single
+// atomic so both the owner and the thieves can claim from it with one
+// compare & swap.  Each share gets its own cache line.
+
+struct alignas(64) WorkerShare {
+  std::atomic<std::uint64_t> range;
+
+  static std::uint64_t Pack(std::uint32_t begin, std::uint32_t end) {
+    return (std::uint64_t{begin} << 32) | end; }
+  static std::uint32_t Begin(std::uint64_t r) { return r >> 32; }
+  static std::uint32_t End(std::uint64_t r) { return r & 0xffffffff; }
+
+  // the owner takes the next task from the front
+  bool Pop(std::uint32_t &task) {
+    std::uint64_t r{range.load()};
+    while (Begin(r) < End(r)) {
+      if (range.compare_exchange_weak(r, Pack(Begin(r) + 1, End(r)))) {
+        task = Begin(r);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // a thief takes the back half, [mid, end)
+  bool Steal(std::uint32_t &mid, std::uint32_t &end) {
+    std::uint64_t r{range.load()};
+    while (Begin(r) < End(r)) {
+      mid = Begin(r) + (End(r) - Begin(r)) / 2;
+      end = End(r);
+      if (range.compare_exchange_weak(r, Pack(Begin(r), mid)))
+        return true;
+    }
+    return false;
+  }
+};
+
+
+void ParallelFor(int num_tasks, int num_threads, const std::function<void(int, int)> &task) {
+  if (num_tasks <= 0) return;
+  num_threads = std::clamp(num_threads, 1, num_tasks);
+  if (num_threads == 1) {
+    for (int i{}; i < num_tasks; ++i) task(i, 0);
+    return;
+  }
+
+  // deal out contiguous shares of the tasks
+  std::vector<WorkerShare> shares(num_threads);
+  for (int t{}; t < num_threads; ++t)
+    shares[t].range = WorkerShare::Pack(
+      std::uint64_t{std::uint32_t(num_tasks)} * t / num_threads,
+      std::uint64_t{std::uint32_t(num_tasks)} * (t + 1) / num_threads);
+
+  auto worker{[&] (int me) {
+    while (true) {
+      std::uint32_t i;
+      while (shares[me].Pop(i))
+        task(i, me);
+      // out of work: steal from the next worker that has some left
+      // (any task missing from every share is already being run)
+      bool stole{false};
+      for (int k{1}; k < num_threads && !stole; ++k) {
+        std::uint32_t mid, end;
+        if (shares[(me + k) % num_threads].Steal(mid, end)) {
+          shares[me].range = WorkerShare::Pack(mid, end);
+          stole = true;
+        }
+      }
+      if (!stole) return;
+    }
+  }};
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (int t{1}; t < num_threads; ++t)
+    threads.emplace_back(worker, t);
+  worker(0);
+  for (auto &t: threads)
+    t.join();
+}
+
+// ====================================================================
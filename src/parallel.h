@@ -0,0 +1,29 @@
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <functional>
+
+// ====================================================================
+// ====================================================================
+// A fixed-size pool of worker threads that share a list of tasks.
+// Every worker starts on its own contiguous share of the task indices
+// and works through it in order.  A worker whose share runs out steals
+// the back half of another worker's remaining share, so expensive
+// tasks near the end don't leave the other cores idle.
+
+// the number of worker threads: the --threads flag, or one per
+// hardware thread if it was not given
+[[nodiscard]] int NumWorkerThreads();
+
+// calls task(index, thread) for every index in [0, num_tasks), where
+// thread in [0, num_threads) identifies the calling worker
+void ParallelFor(int num_tasks, int num_threads, const std::function<void(int, int)> &task);
+
+inline void ParallelFor(int num_tasks, const std::function<void(int, int)> &task) {
+  ParallelFor(num_tasks, NumWorkerThreads(), task);
+}
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef _PHOTON_H_
 #define _PHOTON_H_
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
 #include "vectors.h"
 
 // ===========================================================
@@ -27,4 +31,88 @@ class Photon {
   int bounce;
 };
 
+// ===========================================================
+// The same, packed into 20 bytes for the photon map (Jensen):  the
+// position as 3 floats, the energy as RGBE (an 8 bit mantissa per
+// channel and a shared exponent, Ward), and the direction as 8 bit
+// spherical angles.  Decoding is a few multiplies and table lookups.
+// One byte is left over for the kd-tree's split axis.
+
+class PackedPhoton {
+ public:
+
+  // CONSTRUCTORS
+  PackedPhoton() = default;
+  PackedPhoton(const Vec3f &p, const Vec3f &d, const Vec3f &e, int b) :
+    position{p.x(), p.y(), p.z()},
+    bounce{static_cast<std::uint8_t>(std::min(b, 255))} {
+    // RGBE
+    const float largest{std::max({e.r(), e.g(), e.b()})};
+    if (largest > 1e-32f) {
+      int exponent;
+      const float scale{std::frexp(largest, &exponent) * 256 / largest};
+      energy = {static_cast<std::uint8_t>(std::max(e.r(), 0.f) * scale),
+                static_cast<std::uint8_t>(std::max(e.g(), 0.f) * scale),
+                static_cast<std::uint8_t>(std::max(e.b(), 0.f) * scale),
+                static_cast<std::uint8_t>(exponent + 128)};
+    }
+    // theta from +z, and phi around it
+    const int t = std::acos(std::clamp(d.z(), -1.f, 1.f)) * (256 / M_PI);
+    const int f = std::floor(std::atan2(d.y(), d.x()) * (256 / (2 * M_PI)));
+    theta = std::min(t, 255);
+    phi = f & 255;
+  }
+
+  // ACCESSORS
+  [[nodiscard]] Vec3f getPosition() const { return {position[0], position[1], position[2]}; }
+  [[nodiscard]] float getPosition(int axis) const { return position[axis]; }
+  [[nodiscard]] Vec3f getDirectionFrom() const {
+    const Angles &a{angles()};
+    return {a.sin_theta[theta] * a.cos_phi[phi], a.sin_theta[theta] * a.sin_phi[phi], a.cos_theta[theta]};
+  }
+  [[nodiscard]] Vec3f getEnergy() const {
+    if (energy[3] == 0) return {};
+    // (from the middle of each mantissa step, but keeping 0 at 0)
+    const float scale{std::ldexp(1.f, energy[3] - (128 + 8))};
+    auto channel{[&] (std::uint8_t m) { return m? (m + .5f) * scale : 0.f; }};
+    return {channel(energy[0]), channel(energy[1]), channel(energy[2])};
+  }
+  [[nodiscard]] int whichBounce() const { return bounce; }
+  [[nodiscard]] Photon unpack() const { return {getPosition(), getDirectionFrom(), getEnergy(), bounce}; }
+
+  // for BalancedKDTree
+  [[nodiscard]] int getSplitAxis() const { return split_axis; }
+  void setSplitAxis(int axis) { split_axis = axis; }
+
+ private:
+
+  // the unit vector for each of the 256 values of theta and phi (at
+  // the middle of their ranges)
+  struct Angles {
+    Angles() {
+      for (int i{}; i < 256; ++i) {
+        cos_theta[i] = std::cos((i + .5) * M_PI / 256);
+        sin_theta[i] = std::sin((i + .5) * M_PI / 256);
+        cos_phi[i] = std::cos((i + .5) * 2 * M_PI / 256);
+        sin_phi[i] = std::sin((i + .5) * 2 * M_PI / 256);
+      }
+    }
+    std::array<float, 256> cos_theta, sin_theta, cos_phi, sin_phi;
+  };
+  static const Angles& angles() {
+    static const Angles a;
+    return a;
+  }
+
+  // REPRESENTATION
+  float position[3];
+  std::array<std::uint8_t, 4> energy{};
+  std::uint8_t theta;
+  std::uint8_t phi;
+  std::uint8_t bounce;
+  std::uint8_t split_axis{};
+};
+
+static_assert(sizeof(PackedPhoton) == 20);
+
 #endif
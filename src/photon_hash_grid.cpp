@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <memory>
+
+#include "photon_hash_grid.h"
+#include "parallel.h"
+
+// ==================================================================
+// CONSTRUCTION
+
+PhotonHashGrid::PhotonHashGrid(std::vector<PackedPhoton> unsorted, float r) :
+  radius{r},
+  cell_size{2 * r}
+{
+  assert (radius > 0);
+  const std::size_t n{unsorted.size()};
+  // about 8 photons per bucket:  a gather's worth of photons is spread
+  // over a few cells, and many cells are empty
+  std::size_t num_buckets{1};
+  while (num_buckets < n / 8 && num_buckets < (std::size_t{1} << 31)) num_buckets *= 2;
+  mask = num_buckets - 1;
+
+  // (in chunks, so each task is worth handing to a worker)
+  constexpr std::size_t CHUNK{1 << 14};
+  const int num_chunks = (n + CHUNK - 1) / CHUNK;
+  auto chunks{[&] (auto &&f) {
+    ParallelFor(num_chunks, [&] (int c, int) {
+      for (std::size_t i{c * CHUNK}; i < std::min(n, (c + 1) * CHUNK); ++i) f(i);
+    });
+  }};
+
+  // count the photons in each bucket,
+  std::vector<std::uint32_t> which(n);
+  const std::unique_ptr<std::atomic<std::size_t>[]> count{new std::atomic<std::size_t>[num_buckets]{}};
+  chunks([&] (std::size_t i) {
+    const PackedPhoton &p{unsorted[i]};
+    which[i] = bucket(cell(p.getPosition(0)), cell(p.getPosition(1)), cell(p.getPosition(2)));
+    count[which[i]].fetch_add(1, std::memory_order_relaxed);
+  });
+
+  // which gives where each bucket starts,
+  start.resize(num_buckets + 1);
+  for (std::size_t b{}; b < num_buckets; ++b) {
+    start[b + 1] = start[b] + count[b].load(std::memory_order_relaxed);
+    count[b].store(start[b], std::memory_order_relaxed);
+  }
+
+  // and then deal the photons out to their buckets
+  std::vector<std::uint32_t> order(n);
+  chunks([&] (std::size_t i) {
+    order[count[which[i]].fetch_add(1, std::memory_order_relaxed)] = i;
+  });
+
+  // The workers deal them out in no particular order, so each bucket
+  // is put back in the order the photons came in, to make the
+  // gathers (the order their energies are summed in) the same
+  // however many threads there are.
+  const int num_bucket_chunks = (num_buckets + CHUNK - 1) / CHUNK;
+  ParallelFor(num_bucket_chunks, [&] (int c, int) {
+    for (std::size_t b{c * CHUNK}; b < std::min(num_buckets, (c + 1) * CHUNK); ++b)
+      std::sort(order.begin() + start[b], order.begin() + start[b + 1]);
+  });
+  photons.resize(n);
+  chunks([&] (std::size_t i) {
+    photons[i] = unsorted[order[i]];
+  });
+}
+
+// ==================================================================
+// ACCESSORS
+
+std::vector<BoundingBox> PhotonHashGrid::getCells() const {
+  std::vector<std::array<int, 3>> occupied(photons.size());
+  for (std::size_t i{}; i < photons.size(); ++i)
+    occupied[i] = {cell(photons[i].getPosition(0)), cell(photons[i].getPosition(1)), cell(photons[i].getPosition(2))};
+  std::sort(occupied.begin(), occupied.end());
+  occupied.erase(std::unique(occupied.begin(), occupied.end()), occupied.end());
+
+  std::vector<BoundingBox> cells;
+  cells.reserve(occupied.size());
+  for (const auto &[x, y, z]: occupied) {
+    const Vec3f min{x * cell_size, y * cell_size, z * cell_size};
+    cells.emplace_back(min, min + Vec3f{cell_size, cell_size, cell_size});
+  }
+  return cells;
+}
+
+// ==================================================================
+// QUERIES
+
+float PhotonHashGrid::CollectNearest(const Vec3f &point, int k, float max_distance_sqr,
+                                     std::vector<Neighbor> &nearest) const {
+  nearest.clear();
+  if (photons.empty() || k <= 0) return 0;
+  max_distance_sqr = std::min(max_distance_sqr, radius * radius);
+  const float r{std::sqrt(max_distance_sqr)};
+
+  // the buckets of the cells within r (the one the point is in, and
+  // along each axis, the neighbor on whichever side r reaches, or two
+  // with rounding on a boundary), each just once
+  std::array<std::uint32_t, 27> buckets;
+  std::size_t num_buckets{};
+  int lo[3], hi[3];
+  for (int axis{}; axis < 3; ++axis) {
+    lo[axis] = cell(point[axis] - r);
+    hi[axis] = cell(point[axis] + r);
+  }
+  for (int x{lo[0]}; x <= hi[0]; ++x)
+    for (int y{lo[1]}; y <= hi[1]; ++y)
+      for (int z{lo[2]}; z <= hi[2]; ++z)
+        buckets[num_buckets++] = bucket(x, y, z);
+  std::sort(buckets.begin(), buckets.begin() + num_buckets);
+  num_buckets = std::unique(buckets.begin(), buckets.begin() + num_buckets) - buckets.begin();
+
+  for (std::size_t b{}; b < num_buckets; ++b)
+    for (std::size_t i{start[buckets[b]]}; i < start[buckets[b] + 1]; ++i)
+      Offer(photons[i], DistanceSqr(photons[i], point), k, max_distance_sqr, nearest);
+  return nearest.empty()? 0 : nearest.front().distance_sqr;
+}
+
+// ==================================================================
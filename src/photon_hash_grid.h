@@ -0,0 +1,62 @@
+#ifndef _PHOTON_HASH_GRID_H_
+#define _PHOTON_HASH_GRID_H_
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "boundingbox.h"
+#include "photon_map.h"
+
+// ==================================================================
+// A uniform grid of photons, hashed so that only the occupied cells
+// take any room (Teschner et al., "Optimized Spatial Hashing for
+// Collision Detection of Deformable Objects").  The cells are twice as
+// wide as the gather radius, so a query looks in at most 2x2x2 of
+// them.
+// It's built with a counting sort of the photons by bucket, into one
+// flat array with each bucket's photons together, which is linear in
+// the number of photons and runs on the worker threads:  much cheaper
+// to rebuild than a kd-tree, for maps that are rebuilt every pass.
+// Cells that hash the same share a bucket, so a query skips the
+// photons that are in the bucket but not in the cells.
+
+class PhotonHashGrid : public PhotonMap {
+
+public:
+
+  // ===========
+  // CONSTRUCTOR
+  // (in any order)
+  PhotonHashGrid(std::vector<PackedPhoton> photons, float radius);
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] float getRadius() const { return radius; }
+  // the occupied cells, to draw
+  [[nodiscard]] std::vector<BoundingBox> getCells() const;
+
+  // (only as far as the radius, even if max_distance_sqr is larger)
+  float CollectNearest(const Vec3f &point, int k, float max_distance_sqr,
+                       std::vector<Neighbor> &nearest) const override;
+
+private:
+
+  // HELPER FUNCTIONS
+  [[nodiscard]] int cell(float x) const { return static_cast<int>(std::floor(x / cell_size)); }
+  [[nodiscard]] std::uint32_t bucket(int x, int y, int z) const {
+    return (static_cast<std::uint32_t>(x) * 73856093u ^ static_cast<std::uint32_t>(y) * 19349663u ^
+            static_cast<std::uint32_t>(z) * 83492791u) & mask;
+  }
+
+  // REPRESENTATION
+  float radius;
+  float cell_size;
+  // the photons of bucket b are photons[start[b], start[b+1]), for a
+  // power of 2 buckets
+  std::uint32_t mask;
+  std::vector<std::size_t> start;
+};
+
+// ==================================================================
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _PHOTON_MAP_H_
+#define _PHOTON_MAP_H_
+
+#include <algorithm>
+#include <vector>
+#include "photon.h"
+
+// ==================================================================
+// The photons left in the scene, sorted for the k nearest neighbor
+// queries of density estimation:  a BalancedKDTree or a
+// PhotonHashGrid (see MeshData::photon_map).
+
+class PhotonMap {
+
+public:
+
+  // a photon found by a query, and its squared distance from the point
+  struct Neighbor {
+    float distance_sqr;
+    const PackedPhoton *photon;
+  };
+
+  virtual ~PhotonMap() = default;
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] std::size_t numPhotons() const { return photons.size(); }
+  // in the map's order
+  [[nodiscard]] const std::vector<PackedPhoton>& getPhotons() const { return photons; }
+
+  // Replaces nearest with the k photons nearest to point, no farther
+  // than sqrt(max_distance_sqr) (or all of them, if there are fewer),
+  // in no particular order.  Returns the squared distance to the
+  // farthest of them (0 if there are none).  (A map may search a
+  // smaller radius still, see PhotonHashGrid.)
+  virtual float CollectNearest(const Vec3f &point, int k, float max_distance_sqr,
+                               std::vector<Neighbor> &nearest) const = 0;
+
+protected:
+
+  // Offers the photon at distance_sqr to a query's nearest, kept as a
+  // max-heap by distance so the farthest is the one to replace, and
+  // once there are k, shrinks max_distance_sqr to the farthest.
+  static void Offer(const PackedPhoton &p, float distance_sqr, std::size_t k, float &max_distance_sqr,
+                    std::vector<Neighbor> &nearest) {
+    if (distance_sqr >= max_distance_sqr) return;
+    auto closer{[] (const Neighbor &a, const Neighbor &b) { return a.distance_sqr < b.distance_sqr; }};
+    if (nearest.size() == k) {
+      std::pop_heap(nearest.begin(), nearest.end(), closer);
+      nearest.back() = {distance_sqr, &p};
+    } else {
+      nearest.push_back({distance_sqr, &p});
+    }
+    std::push_heap(nearest.begin(), nearest.end(), closer);
+    if (nearest.size() == k)
+      max_distance_sqr = nearest.front().distance_sqr;
+  }
+
+  static float DistanceSqr(const PackedPhoton &p, const Vec3f &point) {
+    const float dx{p.getPosition(0) - point.x()}, dy{p.getPosition(1) - point.y()}, dz{p.getPosition(2) - point.z()};
+    return dx * dx + dy * dy + dz * dz;
+  }
+
+  // REPRESENTATION
+  std::vector<PackedPhoton> photons;
+};
+
+// ==================================================================
+
+#endif
@@ -1,6 +1,8 @@
+#include <chrono>
 #include <iostream>
 #include <algorithm>
 #include <cstring>
+#include <limits>
 
 #include "argparser.h"
 #include "photon_mapping.h"
@@ -8,55 +10,138 @@
 #include "meshdata.h"
 #include "face.h"
 #include "kdtree.h"
+#include "balanced_kdtree.h"
+#include "photon_hash_grid.h"
+#include "progressive_photon_mapping.h"
+#include "material.h"
+#include "primitive.h"
 #include "utils.h"
 #include "raytracer.h"
+#include "sampler.h"
+#include "parallel.h"
 
 
+// photons traced per task, each batch from one light
+constexpr int PHOTONS_PER_BATCH{4096};
+
 // ==========
 // Clear/reset
 void PhotonMapping::Clear() {
   // cleanup all the photons
-  delete kdtree;
-  kdtree = nullptr;
+  delete photon_map;
+  delete caustic_map;
+  delete irradiance_map;
+  delete progressive;
+  photon_map = nullptr;
+  caustic_map = nullptr;
+  irradiance_map = nullptr;
+  progressive = nullptr;
+  cells.clear();
 }
 
 
 // ========================================================================
 // Recursively trace a single photon
 
-void PhotonMapping::TracePhoton(const Vec3f &/*position*/, const Vec3f &/*direction*/,
-        const Vec3f &/*energy*/, int /*iter*/) {
-
-  // ==============================================
-  // ASSIGNMENT: IMPLEMENT RECURSIVE PHOTON TRACING
-  // ==============================================
-
-  // Trace the photon through the scene.  At each diffuse or
-  // reflective bounce, store the photon in the kd tree.
+void PhotonMapping::TracePhoton(const Vec3f &position, const Vec3f &direction,
+        const Vec3f &energy, int iter, bool caustic, Keep keep, std::vector<PackedPhoton> &photons) const {
+
+  // Trace the photon through the scene.  At each diffuse bounce,
+  // store the photon.
+  const Ray ray{position, direction};
+  Hit hit{};
+  if (!raytracer->CastRay(ray, hit, false)) return;
+  const Material &m{*hit.getMaterial()};
+  // (lights absorb whatever reaches them)
+  if (m.isEmitting()) return;
+  const Vec3f point{ray.pointAtParameter(hit.getT())};
+  Vec3f normal{hit.getNormal()};
+  if (normal.Dot3(direction) > 0) normal.Negate();
+  const Vec3f diffuse{m.getDiffuseColor(hit.get_s(), hit.get_t())};
+  const Vec3f reflective{m.getRoughness() == 0? m.getReflectiveColor() : Vec3f{}};
 
   // One optimization is to *not* store the first bounce, since that
   // direct light can be efficiently computed using classic ray
-  // tracing.
+  // tracing.  (A photon that has only been off mirrors since the light
+  // is a caustic photon, the rest are global.)
+  if (iter > 0 && diffuse.Length() > 0 && (keep == Keep::ALL || caustic == (keep == Keep::CAUSTIC)))
+    photons.emplace_back(point, direction.Normalized(), energy, iter);
+
+  // Russian roulette:  the photon bounces diffusely, or off the
+  // mirror, or is absorbed, with probabilities from the average
+  // reflectances (capped so even a photon between mirrors stops), and
+  // carries on the energy of all of the photons that don't
+  auto average{[] (const Vec3f &c) { return (c.r() + c.g() + c.b()) / 3; }};
+  const float scale{std::min(1.f, 0.95f / (average(diffuse) + average(reflective)))};
+  const float p_diffuse{scale * average(diffuse)}, p_mirror{scale * average(reflective)};
+  const float xi = ArgParser::rand();
+  if (xi < p_diffuse) {
+    // (and after a diffuse bounce, there are no more caustic photons)
+    if (keep == Keep::CAUSTIC) return;
+    // (weighted by the same brdf as the ray tracer uses, over the cosine
+    // weighted pdf of the direction, cos / pi)
+    const Vec3f bounce{RandomDiffuseDirection(normal)};
+    const Vec3f weight{static_cast<float>(M_PI) * m.brdf(hit, direction, bounce) / p_diffuse};
+    TracePhoton(point, bounce, energy * weight, iter + 1, false, keep, photons);
+  } else if (xi < p_diffuse + p_mirror)
+    TracePhoton(point, Reflection(direction, normal), energy * reflective / p_mirror, iter + 1, caustic, keep,
+                photons);
+}
 
+
+// ========================================================================
+// the boxes of the leaves of a KDTree, to draw
+
+static void collectLeaves(const KDTree &kdtree, std::vector<BoundingBox> &leaves) {
+  if (kdtree.isLeaf()) {
+    leaves.emplace_back(kdtree.getMin(), kdtree.getMax());
+    return;
+  }
+  collectLeaves(*kdtree.getChild1(), leaves);
+  collectLeaves(*kdtree.getChild2(), leaves);
 }
 
 
 // ========================================================================
 // Trace the specified number of photons through the scene
 
-void PhotonMapping::TracePhotons() {
+// the mirrors (as the spheres around their bounding boxes), to aim the
+// caustic photons at
+struct SpecularTarget {
+  Vec3f center;
+  float radius;
+};
+
+static std::vector<SpecularTarget> SpecularTargets(const Mesh &mesh) {
+  std::vector<SpecularTarget> targets;
+  auto add{[&] (const Material &m, const BoundingBox &bb) {
+    if (m.getRoughness() != 0 || m.getReflectiveColor().Length() == 0) return;
+    Vec3f center;
+    bb.getCenter(center);
+    const float radius{(bb.getMax() - bb.getMin()).Length() / 2};
+    if (radius > 0) targets.push_back({center, radius});
+  }};
+  for (const Face *f: mesh.getOriginalQuads())
+    add(*f->getMaterial(), f->getBoundingBox());
+  for (const Primitive *p: mesh.getPrimitives())
+    add(*p->getMaterial(), p->getBoundingBox());
+  return targets;
+}
 
-  // first, throw away any existing photons
-  delete kdtree;
+// uniformly distributed over the directions within the cone around
+// axis (a unit vector) with cos_max the cosine of its half angle
+static Vec3f RandomDirectionInCone(const Vec3f &axis, float cos_max) {
+  const float cos_theta = 1 - ArgParser::rand() * (1 - cos_max);
+  const float sin_theta = std::sqrt(std::max(0.f, 1 - cos_theta * cos_theta));
+  const float phi = 2 * M_PI * ArgParser::rand();
+  Vec3f u, v;
+  Vec3f::Cross3(u, std::abs(axis.x()) < 0.9f? Vec3f{1,0,0} : Vec3f{0,1,0}, axis);
+  u.Normalize();
+  Vec3f::Cross3(v, axis, u);
+  return sin_theta * std::cos(phi) * u + sin_theta * std::sin(phi) * v + cos_theta * axis;
+}
 
-  // consruct a kdtree to store the photons
-  BoundingBox *bb = mesh->getBoundingBox();
-  Vec3f min = bb->getMin();
-  Vec3f max = bb->getMax();
-  Vec3f diff = max-min;
-  min -= 0.001f*diff;
-  max += 0.001f*diff;
-  kdtree = new KDTree({min,max});
+std::vector<PackedPhoton> PhotonMapping::ShootPhotons(int num_photons, bool caustic, int pass) const {
 
   // photons emanate from the light sources
   const std::vector<Face*>& lights = mesh->getLights();
@@ -67,70 +152,358 @@ void PhotonMapping::TracePhotons() {
     total_lights_area += faceP->getArea();
   }
 
+  // caustic photons are only shot toward the mirrors
+  const std::vector<SpecularTarget> targets{caustic? SpecularTargets(*mesh) : std::vector<SpecularTarget>{}};
+  if (caustic && targets.empty()) return {};
+  // (and otherwise, the caustic photons are left to the caustic map,
+  // if there is one)
+  const Keep keep{caustic? Keep::CAUSTIC : args->mesh_data->num_caustic_photons_to_shoot > 0? Keep::GLOBAL : Keep::ALL};
+
   // shoot a constant number of photons per unit area of light source
-  // (alternatively, this could be based on the total energy of each light)
-  for (const Face *faceP: lights) {
-    const float my_area = faceP->getArea();
-    const int num = args->mesh_data->num_photons_to_shoot * my_area / total_lights_area;
-    // the initial energy for this photon
-    Vec3f energy = my_area/num * faceP->getMaterial()->getEmittedColor();
-    Vec3f normal = faceP->computeNormal();
-    for (int j = 0; j < num; j++) {
+  // (alternatively, this could be based on the total energy of each light),
+  // split into batches for the worker threads
+  struct Batch {
+    int light;
+    int index;
+    int num;
+  };
+  std::vector<Batch> batches;
+  std::vector<int> num_per_light(lights.size());
+  for (std::size_t i{}; i < lights.size(); ++i) {
+    const int num = num_photons * lights[i]->getArea() / total_lights_area;
+    num_per_light[i] = num;
+    for (int b{}; b * PHOTONS_PER_BATCH < num; ++b)
+      batches.push_back({static_cast<int>(i), b, std::min(PHOTONS_PER_BATCH, num - b * PHOTONS_PER_BATCH)});
+  }
+
+  // Each batch (of each pass) gets its own random stream and its own
+  // list of photons, so the photons are the same however many threads
+  // trace them.
+  std::vector<std::vector<PackedPhoton>> traced(batches.size());
+  ParallelFor(batches.size(), [&] (int b, int) {
+    const Batch &batch{batches[b]};
+    const Face *faceP{lights[batch.light]};
+    Sampler::Current().StartPixel(batch.light, caustic? -1 - batch.index : batch.index, pass);
+    const Vec3f &emitted{faceP->getMaterial()->getEmittedColor()};
+    const float area{faceP->getArea()};
+    const Vec3f normal{faceP->computeNormal()};
+
+    if (!caustic) {
+      // the initial energy for this photon (a share of the light's power,
+      // pi times its area times its radiance)
+      const Vec3f energy{static_cast<float>(M_PI) * area / num_per_light[batch.light] * emitted};
+      for (int j = 0; j < batch.num; j++) {
+        const Vec3f start = faceP->randPoint();
+        // the initial direction for this photon (for diffuse light sources)
+        const Vec3f direction = RandomDiffuseDirection(normal);
+        TracePhoton(start,direction,energy,0,true,keep,traced[b]);
+      }
+      return;
+    }
+
+    // Caustic photons go toward a random mirror, uniformly within the
+    // cone around it.  The pdf of the direction is that of all of the
+    // cones it's in, so the energy of a photon is its share of the
+    // light's power (the radiance times the area and the cosine over
+    // the pdf) whichever cones overlap.
+    struct Cone {
+      Vec3f axis;
+      float cos_max;
+      float pdf;
+    };
+    std::vector<Cone> cones(targets.size());
+    for (int j = 0; j < batch.num; j++) {
       const Vec3f start = faceP->randPoint();
-      // the initial direction for this photon (for diffuse light sources)
-      const Vec3f direction = RandomDiffuseDirection(normal);
-      TracePhoton(start,direction,energy,0);
+      for (std::size_t t{}; t < targets.size(); ++t) {
+        const Vec3f to{targets[t].center - start};
+        const float distance{to.Length()};
+        const float sin_max{targets[t].radius / distance};
+        cones[t].axis = to / distance;
+        cones[t].cos_max = sin_max < 1? std::sqrt(1 - sin_max * sin_max) : -1;
+        cones[t].pdf = 1 / (2 * static_cast<float>(M_PI) * (1 - cones[t].cos_max));
+      }
+      const Cone &cone{cones[std::min<std::size_t>(ArgParser::rand() * cones.size(), cones.size() - 1)]};
+      const Vec3f direction{RandomDirectionInCone(cone.axis, cone.cos_max)};
+      const float cos_theta{direction.Dot3(normal)};
+      if (cos_theta <= 0) continue;
+      float pdf{};
+      for (const Cone &c: cones)
+        if (direction.Dot3(c.axis) >= c.cos_max) pdf += c.pdf;
+      pdf /= cones.size();
+      const Vec3f energy{area * cos_theta / (pdf * num_per_light[batch.light]) * emitted};
+      TracePhoton(start,direction,energy,0,true,keep,traced[b]);
     }
+  });
+
+  // and then the lists are joined, in order
+  std::vector<std::size_t> offset(batches.size() + 1);
+  for (std::size_t b{}; b < batches.size(); ++b)
+    offset[b + 1] = offset[b] + traced[b].size();
+  std::vector<PackedPhoton> photons(offset.back());
+  ParallelFor(batches.size(), [&] (int b, int) {
+    std::copy(traced[b].begin(), traced[b].end(), photons.begin() + offset[b]);
+    traced[b] = {};
+  });
+  return photons;
+}
+
+
+// about as far as it would take to collect num_photons_to_collect of
+// num_photons if they were spread evenly over the surfaces
+float PhotonMapping::EvenGatherRadius(std::size_t num_photons) const {
+  float area{};
+  for (int i{}; i < mesh->numFaces(); ++i)
+    area += mesh->getFace(i)->getArea();
+  return std::sqrt(std::max(1, args->mesh_data->num_photons_to_collect) * area /
+                   (static_cast<float>(M_PI) * std::max<std::size_t>(1, num_photons)));
+}
+
+
+// sorts the photons for gathering within radius (or any distance, with
+// the kd-tree)
+PhotonMap* PhotonMapping::BuildPhotonMap(std::vector<PackedPhoton> photons, float radius) const {
+  if (args->mesh_data->photon_map == PHOTON_MAP_HASH_GRID)
+    return new PhotonHashGrid{std::move(photons), radius};
+  return new BalancedKDTree{std::move(photons)};
+}
+
+
+void PhotonMapping::TracePhotons() {
+
+  // first, throw away any existing photons
+  Clear();
+  using namespace std::chrono;
+  auto tStart{steady_clock::now()};
+  const MeshData &md{*args->mesh_data};
+  std::vector<PackedPhoton> photons{ShootPhotons(md.num_photons_to_shoot, false, 0)};
+  std::vector<PackedPhoton> caustic_photons{ShootPhotons(md.num_caustic_photons_to_shoot, true, 0)};
+
+  // how far to gather from:  if not given, about as far as it would
+  // take if the photons were spread evenly (or unlimited for the
+  // kd-tree, which can find them wherever they are).  The caustic
+  // photons are bunched up, so they're gathered from small discs where
+  // they're dense, but never farther than the even radius, so that
+  // they stay sharp where they aren't.
+  const float even_radius{md.photon_gather_radius > 0? md.photon_gather_radius : EvenGatherRadius(photons.size())};
+  const float radius{md.photon_gather_radius > 0 || md.photon_map == PHOTON_MAP_HASH_GRID? even_radius : 0};
+  max_gather_radius_sqr = radius > 0? radius * radius : std::numeric_limits<float>::infinity();
+  max_caustic_radius_sqr = even_radius * even_radius;
+
+  // sort them for gathering, and into boxes to draw
+  photon_map = BuildPhotonMap(std::move(photons), radius);
+  if (!caustic_photons.empty())
+    caustic_map = BuildPhotonMap(std::move(caustic_photons), even_radius);
+  // and for final gather, the irradiance at some of them
+  std::size_t num_irradiance{};
+  if (md.final_gather_samples > 0 && md.precompute_irradiance > 0) {
+    irradiance_map = BuildPhotonMap(PrecomputeIrradiance(md.precompute_irradiance), radius);
+    num_irradiance = irradiance_map->numPhotons();
   }
+  if (!args->headless) {
+    if (md.photon_map == PHOTON_MAP_HASH_GRID) {
+      cells = static_cast<const PhotonHashGrid*>(photon_map)->getCells();
+    } else {
+      BoundingBox *bb = mesh->getBoundingBox();
+      Vec3f min = bb->getMin();
+      Vec3f max = bb->getMax();
+      Vec3f diff = max-min;
+      min -= 0.001f*diff;
+      max += 0.001f*diff;
+      KDTree kdtree({min,max});
+      for (const PackedPhoton &p: photon_map->getPhotons())
+        kdtree.AddPhoton(p.unpack());
+      collectLeaves(kdtree, cells);
+    }
+  }
+
+  const int numThreads{NumWorkerThreads()};
+  auto p{std::cout.precision(2)};
+  std::cout << "Traced " << photon_map->numPhotons() << " photons";
+  if (caustic_map != nullptr)
+    std::cout << " and " << caustic_map->numPhotons() << " caustic photons";
+  if (irradiance_map != nullptr)
+    std::cout << " (and precomputed the irradiance at " << num_irradiance << ")";
+  (std::cout << " in " << std::fixed
+    << duration_cast<duration<float>>(steady_clock::now() - tStart).count() << " seconds on "
+    << numThreads << " thread" << (numThreads == 1? "." : "s.") << std::endl
+    << std::defaultfloat).precision(p);
 }
 
 
-// ======================================================================
+// ========================================================================
+// Progressive photon mapping
+
+std::vector<Vec3f> PhotonMapping::RenderProgressive(int width, int height, int samples_per_pixel) {
+  Clear();
+  using namespace std::chrono;
+  auto tStart{steady_clock::now()};
+  const MeshData &md{*args->mesh_data};
+  progressive = new ProgressivePhotonMapping{md.progressive_alpha};
+
+  // the eye pass
+  progressive->TraceVisiblePoints(width, height, samples_per_pixel, [&] (int i, int j) {
+    return raytracer->renderPixel(i, j);
+  });
+
+  // and the photon passes, each with a new map that's thrown away after
+  // (none if every path ended on a light, the background or a mirror:
+  // there'd be nothing to gather at, nor a radius to build the map for)
+  std::size_t num_photons{};
+  const int num_passes{progressive->numVisiblePoints() > 0? md.progressive_photon_passes : 0};
+  for (int pass{}; pass < num_passes; ++pass) {
+    std::vector<PackedPhoton> photons{ShootPhotons(md.num_photons_to_shoot, false, pass)};
+    if (pass == 0)
+      progressive->setRadius(md.photon_gather_radius > 0? md.photon_gather_radius : EvenGatherRadius(photons.size()));
+    // (the caustic photons too, which are only denser where they land)
+    const std::vector<PackedPhoton> caustic_photons{ShootPhotons(md.num_caustic_photons_to_shoot, true, pass)};
+    photons.insert(photons.end(), caustic_photons.begin(), caustic_photons.end());
+    num_photons += photons.size();
+    const PhotonMap *map{BuildPhotonMap(std::move(photons), progressive->maxRadius())};
+    progressive->Gather(*map);
+    delete map;
+  }
+
+  const int numThreads{NumWorkerThreads()};
+  auto p{std::cout.precision(2)};
+  (std::cout << "Gathered " << num_photons << " photons in " << progressive->numPasses() << " passes at "
+    << progressive->numVisiblePoints() << " visible points in " << std::fixed
+    << duration_cast<duration<float>>(steady_clock::now() - tStart).count() << " seconds on "
+    << numThreads << " thread" << (numThreads == 1? "." : "s.") << std::endl
+    << std::defaultfloat).precision(p);
+  return progressive->getRadiance();
+}
 
-// helper function
-bool closest_photon(const std::pair<Photon,float> &a, const std::pair<Photon,float> &b) {
-  return a.second < b.second;
+bool PhotonMapping::AddVisiblePoint(const Vec3f &point, const Vec3f &normal, const Vec3f &direction_from,
+                                    const Vec3f &weight) const {
+  return progressive != nullptr && ProgressivePhotonMapping::AddVisiblePoint(point, normal, direction_from, weight);
 }
 
 
 // ======================================================================
-Vec3f PhotonMapping::GatherIndirect(const Vec3f &/*point*/, const Vec3f &/*normal*/,
-                                    const Vec3f &/*direction_from*/) const {
+
+// the irradiance from the k photons of the map nearest the point, no
+// farther than sqrt(max_radius_sqr)
+static Vec3f Irradiance(const PhotonMap &map, const Vec3f &point, const Vec3f &normal,
+                        const Vec3f &direction_from, int k, float max_radius_sqr) {
+  // (each thread reuses its own list)
+  thread_local std::vector<PhotonMap::Neighbor> nearest;
+  float radius_sqr{map.CollectNearest(point, k, max_radius_sqr, nearest)};
+  // (if there weren't that many in reach, they came from all of it)
+  if (nearest.size() < static_cast<std::size_t>(k) && std::isfinite(max_radius_sqr))
+    radius_sqr = max_radius_sqr;
+  if (!(radius_sqr > 0)) return {0,0,0};
+
+  // the energy of those that arrived on the side being looked at over
+  // the area of the disc that was necessary to collect them
+  const bool front{direction_from.Dot3(normal) < 0};
+  Vec3f energy;
+  for (const auto &[distance_sqr, p]: nearest)
+    if ((p->getDirectionFrom().Dot3(normal) < 0) == front)
+      energy += p->getEnergy();
+  return energy / (static_cast<float>(M_PI) * radius_sqr);
+}
+
+Vec3f PhotonMapping::GatherIndirect(const Vec3f &point, const Vec3f &normal,
+                                    const Vec3f &direction_from) const {
 
 
-  if (kdtree == nullptr) {
+  if (photon_map == nullptr) {
     std::cout << "WARNING: Photons have not been traced throughout the scene." << std::endl;
     return {0,0,0};
   }
 
-  // ================================================================
-  // ASSIGNMENT: GATHER THE INDIRECT ILLUMINATION FROM THE PHOTON MAP
-  // ================================================================
+  const MeshData &md{*args->mesh_data};
+  Vec3f irradiance{Irradiance(*photon_map, point, normal, direction_from, md.num_photons_to_collect,
+                              max_gather_radius_sqr)};
+  if (caustic_map != nullptr)
+    irradiance += Irradiance(*caustic_map, point, normal, direction_from, md.num_caustic_photons_to_collect,
+                             max_caustic_radius_sqr);
+  return irradiance;
+}
+
+Vec3f PhotonMapping::GatherCaustics(const Vec3f &point, const Vec3f &normal,
+                                     const Vec3f &direction_from) const {
+  if (caustic_map == nullptr) return {0,0,0};
+  return Irradiance(*caustic_map, point, normal, direction_from, args->mesh_data->num_caustic_photons_to_collect,
+                    max_caustic_radius_sqr);
+}
+
 
-  // collect the closest args->num_photons_to_collect photons
-  // determine the radius that was necessary to collect that many photons
-  // average the energy of those photons over that radius
+// ======================================================================
+// Final gather with precomputed irradiance (Christensen):  the final
+// gather's rays hit all over, so rather than gathering the photons
+// where each lands, the irradiance is gathered once at every few
+// photons, and each takes that of the nearest.
+
+std::vector<PackedPhoton> PhotonMapping::PrecomputeIrradiance(int spacing) const {
+  const std::vector<PackedPhoton> &photons{photon_map->getPhotons()};
+  const std::size_t n{(photons.size() + spacing - 1) / spacing};
+  std::vector<PackedPhoton> sites(n);
+  std::vector<char> found(n);
+  constexpr std::size_t CHUNK{256};
+  ParallelFor((n + CHUNK - 1) / CHUNK, [&] (int c, int) {
+    for (std::size_t i{c * CHUNK}; i < std::min(n, (c + 1) * CHUNK); ++i) {
+      const PackedPhoton &p{photons[i * spacing]};
+      // The photons don't keep the normal where they landed, so it's
+      // found again by backing up along the way the photon came and
+      // following it back to the surface.  (Those that aren't found
+      // there, beside another surface, are skipped.)
+      const Vec3f position{p.getPosition()}, direction{p.getDirectionFrom()};
+      constexpr float back{10 * EPSILON};
+      const Ray ray{position - back * direction, direction};
+      Hit hit{};
+      if (!raytracer->CastRay(ray, hit, false) || std::abs(hit.getT() - back) > back / 2) continue;
+      Vec3f normal{hit.getNormal()};
+      if (normal.Dot3(direction) > 0) normal.Negate();
+      sites[i] = {position, normal, GatherIndirect(position, normal, direction), p.whichBounce()};
+      found[i] = true;
+    }
+  });
+  // (in the photons' order, however many threads there are)
+  std::size_t num_found{};
+  for (std::size_t i{}; i < n; ++i)
+    if (found[i]) sites[num_found++] = sites[i];
+  sites.resize(num_found);
+  return sites;
+}
 
-  // return the color
-  return {0,0,0};
+Vec3f PhotonMapping::LookupIrradiance(const Vec3f &point, const Vec3f &normal,
+                                      const Vec3f &direction_from) const {
+  if (irradiance_map == nullptr) return GatherIndirect(point, normal, direction_from);
+
+  // (a few, in case the nearest is around a corner)
+  constexpr int NUM_NEAREST{8};
+  thread_local std::vector<PhotonMap::Neighbor> nearest;
+  irradiance_map->CollectNearest(point, NUM_NEAREST, max_gather_radius_sqr, nearest);
+  const Vec3f side{direction_from.Dot3(normal) < 0? normal : -normal};
+  const PackedPhoton *closest{};
+  float closest_distance_sqr{std::numeric_limits<float>::infinity()};
+  for (const auto &[distance_sqr, p]: nearest)
+    if (distance_sqr < closest_distance_sqr && p->getDirectionFrom().Dot3(side) > 0.9f) {
+      closest = p;
+      closest_distance_sqr = distance_sqr;
+    }
+  if (closest == nullptr) return GatherIndirect(point, normal, direction_from);
+  return closest->getEnergy();
 }
 
+
 // ======================================================================
 // ======================================================================
 // Helper functions to render the photons & kdtree
 
 std::size_t PhotonMapping::triCount() const {
   std::size_t tri_count{};
-  if (GLOBAL_args->mesh_data->render_kdtree && kdtree)
-    tri_count += kdtree->numBoxes()*12*12;
-  if (GLOBAL_args->mesh_data->render_photon_directions && kdtree)
-    tri_count += kdtree->numPhotons()*12;
+  if (GLOBAL_args->mesh_data->render_kdtree)
+    tri_count += cells.size()*12*12;
+  if (GLOBAL_args->mesh_data->render_photon_directions && photon_map && !args->headless)
+    tri_count += (photon_map->numPhotons() + (caustic_map? caustic_map->numPhotons() : 0))*12;
   return tri_count;
 }
 
 std::size_t PhotonMapping::pointCount() const {
-  if (GLOBAL_args->mesh_data->render_photons == false || kdtree == nullptr) return 0;
-  return kdtree->numPhotons();
+  if (GLOBAL_args->mesh_data->render_photons == false || photon_map == nullptr || args->headless) return 0;
+  return photon_map->numPhotons() + (caustic_map? caustic_map->numPhotons() : 0);
 }
 
 // defined in raytree.cpp
@@ -138,13 +511,10 @@ void addBox(float* &current, const Vec3f &start, const Vec3f &end, const Vec3f &
 
 // ======================================================================
 
-void packKDTree(const KDTree *kdtree, float* &current, std::size_t &count) {
-  if (!kdtree->isLeaf()) {
-    if (kdtree->getChild1()) packKDTree(kdtree->getChild1(),current,count);
-    if (kdtree->getChild2()) packKDTree(kdtree->getChild2(),current,count);
-  } else {
-    const Vec3f &a = kdtree->getMin();
-    const Vec3f &b = kdtree->getMax();
+void packCells(const std::vector<BoundingBox> &cells, float* &current, std::size_t &count) {
+  for (const BoundingBox &cell: cells) {
+    const Vec3f &a = cell.getMin();
+    const Vec3f &b = cell.getMax();
 
     Vec3f corners[]{
       {a.x(),a.y(),a.z()},
@@ -180,14 +550,9 @@ void packKDTree(const KDTree *kdtree, float* &current, std::size_t &count) {
 
 // ======================================================================
 
-void packPhotons(const KDTree *kdtree, float* &current_points, std::size_t &count) {
-  if (!kdtree->isLeaf()) {
-    if (kdtree->getChild1()) packPhotons(kdtree->getChild1(),current_points,count);
-    if (kdtree->getChild2()) packPhotons(kdtree->getChild2(),current_points,count);
-    return;
-  }
-  for (std::size_t i{}; i < kdtree->getPhotons().size(); i++) {
-    const Photon &p = kdtree->getPhotons()[i];
+void packPhotons(const std::vector<PackedPhoton> &photons, float* &current_points, std::size_t &count) {
+  for (const PackedPhoton &packed: photons) {
+    const Photon p{packed.unpack()};
     const Vec3f &v = p.getPosition();
     const Vec3f color = p.getEnergy()*GLOBAL_args->mesh_data->num_photons_to_shoot;
     float12 t{ float(v.x()),float(v.y()),float(v.z()),1,   0,0,0,0,   float(color.r()),float(color.g()),float(color.b()),1 };
@@ -197,43 +562,41 @@ void packPhotons(const KDTree *kdtree, float* &current_points, std::size_t &coun
 }
 
 
-void packPhotonDirections(const KDTree *kdtree, float* &current, std::size_t &count) {
-  if (!kdtree->isLeaf()) {
-      if (kdtree->getChild1()) packPhotonDirections(kdtree->getChild1(),current,count);
-      if (kdtree->getChild2()) packPhotonDirections(kdtree->getChild2(),current,count);
-  } else {
-    for (std::size_t i{}; i < kdtree->getPhotons().size(); i++) {
-      const Photon &p = kdtree->getPhotons()[i];
-      const Vec3f &v = p.getPosition();
-      const Vec3f v2 = p.getPosition() - p.getDirectionFrom() * 0.5;
-      const Vec3f color = p.getEnergy()*float(GLOBAL_args->mesh_data->num_photons_to_shoot);
-      const float width = 0.01f;
-      addBox(current,v,v2,color,width);
-      count++;
-    }
+void packPhotonDirections(const std::vector<PackedPhoton> &photons, float* &current, std::size_t &count) {
+  for (const PackedPhoton &packed: photons) {
+    const Photon p{packed.unpack()};
+    const Vec3f &v = p.getPosition();
+    const Vec3f v2 = p.getPosition() - p.getDirectionFrom() * 0.5;
+    const Vec3f color = p.getEnergy()*float(GLOBAL_args->mesh_data->num_photons_to_shoot);
+    const float width = 0.01f;
+    addBox(current,v,v2,color,width);
+    count++;
   }
 }
 
 // ======================================================================
 
 void PhotonMapping::packMesh(float* &current, float* &current_points) {
-  // the photons
-  if (GLOBAL_args->mesh_data->render_photons && kdtree) {
+  if (photon_map == nullptr || args->headless) return;
+  // the photons (global and caustic)
+  if (GLOBAL_args->mesh_data->render_photons) {
     std::size_t count{};
-    packPhotons(kdtree,current_points,count);
-    assert (count == kdtree->numPhotons());
+    packPhotons(photon_map->getPhotons(),current_points,count);
+    if (caustic_map) packPhotons(caustic_map->getPhotons(),current_points,count);
+    assert (count == pointCount());
   }
   // photon directions
-  if (GLOBAL_args->mesh_data->render_photon_directions && kdtree) {
+  if (GLOBAL_args->mesh_data->render_photon_directions) {
     std::size_t count{};
-    packPhotonDirections(kdtree,current,count);
-    assert (count == kdtree->numPhotons());
+    packPhotonDirections(photon_map->getPhotons(),current,count);
+    if (caustic_map) packPhotonDirections(caustic_map->getPhotons(),current,count);
+    assert (count == photon_map->numPhotons() + (caustic_map? caustic_map->numPhotons() : 0));
   }
-  // the wireframe kdtree
-  if (GLOBAL_args->mesh_data->render_kdtree && kdtree) {
+  // the wireframe kdtree or grid
+  if (GLOBAL_args->mesh_data->render_kdtree) {
     std::size_t count{};
-    packKDTree(kdtree,current,count);
-    assert (count == kdtree->numBoxes());
+    packCells(cells,current,count);
+    assert (count == cells.size());
   }
 }
 
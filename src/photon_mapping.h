@@ -3,11 +3,13 @@
 
 #include <vector>
 
+#include "boundingbox.h"
 #include "photon.h"
 
 class Mesh;
 class ArgParser;
-class KDTree;
+class PhotonMap;
+class ProgressivePhotonMapping;
 class Ray;
 class Hit;
 class RayTracer;
@@ -26,7 +28,12 @@ class PhotonMapping {
     mesh = _mesh;
     args = _args;
     raytracer = nullptr;
-    kdtree = nullptr;
+    photon_map = nullptr;
+    caustic_map = nullptr;
+    irradiance_map = nullptr;
+    max_gather_radius_sqr = 0;
+    max_caustic_radius_sqr = 0;
+    progressive = nullptr;
   }
   ~PhotonMapping() { Clear(); }
   void setRayTracer(RayTracer *r) { raytracer = r; }
@@ -35,7 +42,26 @@ class PhotonMapping {
   // step 1: send the photons throughout the scene
   void TracePhotons();
   // step 2: collect the photons and return the contribution from indirect illumination
+  // (the irradiance, for the brdf to scale)
   [[nodiscard]] Vec3f GatherIndirect(const Vec3f &point, const Vec3f &normal, const Vec3f &direction_from) const;
+  // or for final gather:  at the camera hit, only the caustics (what
+  // the final gather can't find, off mirrors), and where its rays hit,
+  // the precomputed irradiance of the nearest photon on the same side
+  // facing the same way (or the full gather, if there isn't one)
+  [[nodiscard]] bool hasCausticMap() const { return caustic_map != nullptr; }
+  [[nodiscard]] Vec3f GatherCaustics(const Vec3f &point, const Vec3f &normal, const Vec3f &direction_from) const;
+  [[nodiscard]] Vec3f LookupIrradiance(const Vec3f &point, const Vec3f &normal, const Vec3f &direction_from) const;
+
+  // or instead, progressive photon mapping (for
+  // MeshData::progressive_photon_passes):  the radiance of every pixel,
+  // by row, averaged over samples_per_pixel
+  [[nodiscard]] std::vector<Vec3f> RenderProgressive(int width, int height, int samples_per_pixel);
+  // (during its eye pass, in place of GatherIndirect:  leaves the
+  // diffuse indirect light at the point, weighted by the fraction that
+  // reaches the camera, to the photon passes; false if this thread
+  // isn't tracing the eye pass)
+  [[nodiscard]] bool AddVisiblePoint(const Vec3f &point, const Vec3f &normal, const Vec3f &direction_from,
+                                     const Vec3f &weight) const;
 
   void Clear();
   
@@ -45,11 +71,39 @@ class PhotonMapping {
   
  private:
 
-  // trace a single photon
-  void TracePhoton(const Vec3f &position, const Vec3f &direction, const Vec3f &energy, int iter);
+  // which photons TracePhoton keeps:  all of them, or only those that
+  // have (caustic) or haven't (global) been only off mirrors since the
+  // light
+  enum class Keep { ALL, GLOBAL, CAUSTIC };
+
+  // trace a single photon, adding where it lands to photons (caustic
+  // if it's only been off mirrors so far)
+  void TracePhoton(const Vec3f &position, const Vec3f &direction, const Vec3f &energy, int iter,
+                   bool caustic, Keep keep, std::vector<PackedPhoton> &photons) const;
+  // num_photons from the lights (the caustic ones toward the mirrors),
+  // with the random streams of pass
+  [[nodiscard]] std::vector<PackedPhoton> ShootPhotons(int num_photons, bool caustic, int pass) const;
+  [[nodiscard]] float EvenGatherRadius(std::size_t num_photons) const;
+  [[nodiscard]] PhotonMap* BuildPhotonMap(std::vector<PackedPhoton> photons, float radius) const;
+  // every spacing'th photon of the map, with the irradiance gathered
+  // there for its energy and the normal of its side for its direction
+  [[nodiscard]] std::vector<PackedPhoton> PrecomputeIrradiance(int spacing) const;
 
   // REPRESENTATION
-  KDTree *kdtree;
+  // the photons, for GatherIndirect, and the caustic photons, if they
+  // were shot separately
+  PhotonMap *photon_map;
+  PhotonMap *caustic_map;
+  // and the photons with precomputed irradiance, for LookupIrradiance
+  PhotonMap *irradiance_map;
+  // (the farthest it looks for them, squared)
+  float max_gather_radius_sqr;
+  float max_caustic_radius_sqr;
+  // the map's cells, to draw (only with a window; for the kd-tree,
+  // those of a KDTree of the same photons)
+  std::vector<BoundingBox> cells;
+  // the visible points, for RenderProgressive
+  ProgressivePhotonMapping *progressive;
   Mesh *mesh;
   ArgParser *args;
   RayTracer *raytracer;
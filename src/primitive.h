@@ -6,6 +6,7 @@ class Ray;
 class Hit;
 class Material;
 class ArgParser;
+class BoundingBox;
 
 // ====================================================================
 // The base class for implicit object representations.  These objects
@@ -21,6 +22,9 @@ class Primitive {
 
   // for ray tracing
   [[nodiscard]] virtual bool intersect(const Ray &r, Hit &h) const = 0;
+  // any intersection before t_max?  (for shadow & visibility rays)
+  [[nodiscard]] virtual bool occludes(const Ray &r, float t_max) const = 0;
+  [[nodiscard]] virtual BoundingBox getBoundingBox() const = 0;
 
   // for OpenGL rendering & radiosity
   virtual void addRasterizedFaces(Mesh *m, ArgParser *args) = 0;
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+
+#include "progressive_photon_mapping.h"
+#include "photon_map.h"
+#include "parallel.h"
+
+// ====================================================================
+// where the eye pass puts the visible points of the pixel each worker
+// is tracing
+
+struct ProgressivePhotonMapping::EyePass {
+  std::vector<VisiblePoint> *visible_points;
+  int pixel;
+  float sample_weight;
+};
+
+thread_local ProgressivePhotonMapping::EyePass *ProgressivePhotonMapping::eye_pass{nullptr};
+
+// ====================================================================
+
+ProgressivePhotonMapping::ProgressivePhotonMapping(float a) :
+  alpha{a},
+  num_passes{}
+{
+  assert (alpha > 0 && alpha <= 1);
+}
+
+float ProgressivePhotonMapping::maxRadius() const {
+  float max_radius_sqr{};
+  for (const VisiblePoint &vp: visible_points)
+    max_radius_sqr = std::max(max_radius_sqr, vp.radius_sqr);
+  return std::sqrt(max_radius_sqr);
+}
+
+std::vector<Vec3f> ProgressivePhotonMapping::getRadiance() const {
+  // (each pass's photons carry all of the lights' power, so the flux is
+  // averaged over the passes)
+  std::vector<Vec3f> radiance{direct};
+  if (num_passes == 0) return radiance;
+  for (const VisiblePoint &vp: visible_points)
+    if (vp.radius_sqr > 0)
+      radiance[vp.pixel] += vp.weight * vp.flux / (static_cast<float>(M_PI) * vp.radius_sqr * num_passes);
+  return radiance;
+}
+
+// ====================================================================
+// THE EYE PASS
+
+void ProgressivePhotonMapping::TraceVisiblePoints(int width, int height, int samples_per_pixel,
+                                                  const std::function<Vec3f(int, int)> &renderPixel) {
+  direct.assign(std::size_t(width) * height, {});
+  visible_points.clear();
+  num_passes = 0;
+
+  // a list for each row, joined in order afterwards, so that the
+  // visible points are the same however many threads there are
+  std::vector<std::vector<VisiblePoint>> rows(height);
+  ParallelFor(height, [&] (int j, int) {
+    EyePass pass{&rows[j], 0, 1.f / samples_per_pixel};
+    eye_pass = &pass;
+    for (int i{}; i < width; ++i) {
+      pass.pixel = j * width + i;
+      direct[pass.pixel] = renderPixel(i, j);
+    }
+    eye_pass = nullptr;
+  });
+  for (std::vector<VisiblePoint> &row: rows)
+    visible_points.insert(visible_points.end(), row.begin(), row.end());
+}
+
+bool ProgressivePhotonMapping::AddVisiblePoint(const Vec3f &position, const Vec3f &normal,
+                                               const Vec3f &direction_from, const Vec3f &weight) {
+  if (eye_pass == nullptr) return false;
+  if (weight.Length() > 0)
+    eye_pass->visible_points->push_back({position, normal, direction_from, weight * eye_pass->sample_weight,
+                                         eye_pass->pixel, 0, 0, {}});
+  return true;
+}
+
+void ProgressivePhotonMapping::setRadius(float radius) {
+  for (VisiblePoint &vp: visible_points)
+    vp.radius_sqr = radius * radius;
+}
+
+// ====================================================================
+// A PHOTON PASS
+
+void ProgressivePhotonMapping::Gather(const PhotonMap &photons) {
+  constexpr std::size_t CHUNK{256};
+  const std::size_t n{visible_points.size()};
+  ParallelFor((n + CHUNK - 1) / CHUNK, [&] (int c, int) {
+    thread_local std::vector<PhotonMap::Neighbor> nearest;
+    for (std::size_t v{c * CHUNK}; v < std::min(n, (c + 1) * CHUNK); ++v) {
+      VisiblePoint &vp{visible_points[v]};
+      // all of the photons within the radius that arrived on the side
+      // being looked at
+      photons.CollectNearest(vp.position, std::numeric_limits<int>::max(), vp.radius_sqr, nearest);
+      const bool front{vp.direction_from.Dot3(vp.normal) < 0};
+      int num_new{};
+      Vec3f flux_new;
+      for (const auto &[distance_sqr, p]: nearest)
+        if ((p->getDirectionFrom().Dot3(vp.normal) < 0) == front) {
+          ++num_new;
+          flux_new += p->getEnergy();
+        }
+      if (num_new == 0) continue;
+
+      // keep alpha of the new ones, and shrink the disc to match
+      const float num_photons{vp.num_photons + alpha * num_new};
+      const float shrink{num_photons / (vp.num_photons + num_new)};
+      vp.radius_sqr *= shrink;
+      vp.flux = (vp.flux + flux_new) * shrink;
+      vp.num_photons = num_photons;
+    }
+  });
+  ++num_passes;
+}
+
+// ====================================================================
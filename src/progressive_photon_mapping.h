@@ -0,0 +1,90 @@
+#ifndef _PROGRESSIVE_PHOTON_MAPPING_H_
+#define _PROGRESSIVE_PHOTON_MAPPING_H_
+
+#include <functional>
+#include <vector>
+#include "vectors.h"
+
+class PhotonMap;
+
+// ====================================================================
+// ====================================================================
+// Progressive photon mapping (Hachisuka, Ogaki & Jensen).  An eye
+// pass traces every pixel once, keeping what the ray tracer found
+// (the direct light, and whatever it saw in mirrors) and the visible
+// points where its paths ended on diffuse surfaces.  Then any number
+// of photon passes, each of which traces a bounded number of photons,
+// adds the flux of those within each visible point's radius, and
+// throws them away.  After each pass, a visible point keeps only the
+// fraction alpha of the photons it has just taken in, and shrinks its
+// radius so that the density it has measured stays the same.  The
+// radius goes to zero (so the bias does too) while the number of
+// photons behind each estimate still grows, and the memory needed
+// stays that of one pass.
+
+class ProgressivePhotonMapping {
+
+public:
+
+  // ===========
+  // CONSTRUCTOR
+  explicit ProgressivePhotonMapping(float alpha);
+
+  // =========
+  // ACCESSORS
+  [[nodiscard]] std::size_t numVisiblePoints() const { return visible_points.size(); }
+  [[nodiscard]] int numPasses() const { return num_passes; }
+  [[nodiscard]] float maxRadius() const;
+  // of each pixel, by row (j * width + i)
+  [[nodiscard]] std::vector<Vec3f> getRadiance() const;
+
+  // =========
+  // MODIFIERS
+  // The eye pass:  renderPixel(i, j) is called (on the worker threads)
+  // for each pixel, and returns its radiance, averaged over its
+  // samples_per_pixel camera samples, except for the diffuse indirect
+  // light it leaves to the visible points it adds.
+  void TraceVisiblePoints(int width, int height, int samples_per_pixel,
+                          const std::function<Vec3f(int, int)> &renderPixel);
+  // (for renderPixel:  records a visible point for the pixel being
+  // traced, with the fraction of the light reflected there toward the
+  // camera that reaches it, or returns false if this thread isn't
+  // tracing any)
+  static bool AddVisiblePoint(const Vec3f &position, const Vec3f &normal, const Vec3f &direction_from,
+                              const Vec3f &weight);
+  // the radius to start every visible point with
+  void setRadius(float radius);
+  // a photon pass, with its photons
+  void Gather(const PhotonMap &photons);
+
+private:
+
+  struct VisiblePoint {
+    Vec3f position;
+    Vec3f normal;
+    Vec3f direction_from;
+    Vec3f weight;
+    int pixel;
+    // the disc, the (fractional) number of photons it's counted, and
+    // their energy
+    float radius_sqr;
+    float num_photons;
+    Vec3f flux;
+  };
+
+  // (what the eye pass on this thread is tracing)
+  struct EyePass;
+  static thread_local EyePass *eye_pass;
+
+  // REPRESENTATION
+  float alpha;
+  int num_passes;
+  // from the eye pass
+  std::vector<Vec3f> direct;
+  std::vector<VisiblePoint> visible_points;
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -1,3 +1,6 @@
+#include <array>
+#include <iostream>
+#include <vector>
 #include "vectors.h"
 #include "radiosity.h"
 #include "mesh.h"
@@ -5,6 +8,10 @@
 #include "face.h"
 #include "raytracer.h"
 #include "utils.h"
+#include "parallel.h"
+#include "hemicube.h"
+#include "hierarchical_radiosity.h"
+#include "form_factor_cache.h"
 
 // ================================================================
 // CONSTRUCTOR & DESTRUCTOR
@@ -14,13 +21,17 @@ Radiosity::Radiosity(Mesh *m, ArgParser *a):
   args{a},
   num_faces{-1},
   formfactors{},
+  sparse_formfactors{},
+  formfactor_cache{},
+  hierarchy{},
   area{},
   undistributed{},
   absorbed{},
   radiance{},
   normals{},
   max_undistributed_patch{-1},
-  total_area{-1}
+  total_area{-1},
+  num_sweeps{}
 {
   Reset();
 }
@@ -30,7 +41,13 @@ Radiosity::~Radiosity() {
 }
 
 void Radiosity::Cleanup() {
-  delete [] formfactors;
+  // (mapped form factors belong to the cache)
+  if (formfactor_cache != nullptr)
+    delete formfactor_cache;
+  else
+    delete [] formfactors;
+  delete sparse_formfactors;
+  delete hierarchy;
   delete [] area;
   delete [] undistributed;
   delete [] absorbed;
@@ -38,6 +55,9 @@ void Radiosity::Cleanup() {
   delete [] normals;
   num_faces = -1;
   formfactors = nullptr;
+  sparse_formfactors = nullptr;
+  formfactor_cache = nullptr;
+  hierarchy = nullptr;
   area = nullptr;
   undistributed = nullptr;
   absorbed = nullptr;
@@ -48,6 +68,9 @@ void Radiosity::Cleanup() {
 }
 
 void Radiosity::Reset() {
+  // (the hierarchy starts over from the emitted light)
+  delete hierarchy;
+  hierarchy = nullptr;
   delete [] area;
   delete [] undistributed;
   delete [] absorbed;
@@ -71,6 +94,7 @@ void Radiosity::Reset() {
     setRadiance(i,emit);
     normals[i] = f->computeNormal();
   }
+  num_sweeps = 0;
 
   // find the patch with the most undistributed energy
   findMaxUndistributed();
@@ -83,48 +107,213 @@ void Radiosity::Reset() {
 void Radiosity::findMaxUndistributed() {
   // find the patch with the most undistributed energy
   // don't forget that the patches may have different sizes!
-  max_undistributed_patch = -1;
+  std::vector<float> energy(num_faces);
   total_undistributed = 0;
   total_area = 0;
-  float max = -1;
   for (int i = 0; i < num_faces; i++) {
-    float m = getUndistributed(i).Length() * getArea(i);
-    total_undistributed += m;
+    energy[i] = getUndistributed(i).Length() * getArea(i);
+    total_undistributed += energy[i];
     total_area += getArea(i);
-    if (max < m) {
-      max = m;
-      max_undistributed_patch = i;
-    }
   }
+  // (kept up to date by each shot from then on)
+  undistributed_heap = IndexedMaxHeap{std::move(energy)};
+  max_undistributed_patch = undistributed_heap.top();
   assert (max_undistributed_patch >= 0 && max_undistributed_patch < num_faces);
 }
 
 
+// above this many patches (a 256 MB dense matrix), only the nonzero
+// form factors are stored (which takes twice as long for the ray cast
+// form factors)
+constexpr auto SPARSE_FORM_FACTORS_MIN_PATCHES{8192};
+
+// Sample points on a pair of patches, one coordinate per array, so the
+// kernel of the whole batch of sample pairs is computed in a single
+// loop the compiler can vectorize.  (Each thread reuses its own.)
+struct FormFactorSamples {
+  explicit FormFactorSamples(int n): xi(n), yi(n), zi(n), xj(n), yj(n), zj(n), kernel(n) {}
+  std::vector<float> xi, yi, zi;
+  std::vector<float> xj, yj, zj;
+  std::vector<float> kernel;
+};
+
 void Radiosity::ComputeFormFactors() {
-  assert (formfactors == nullptr);
+  assert (!hasFormFactors());
   assert (num_faces > 0);
-  formfactors = new float[num_faces*num_faces];
 
+  const bool sparse{num_faces >= SPARSE_FORM_FACTORS_MIN_PATCHES || args->mesh_data->sparse_form_factors};
+  // the last run's, if they were saved for the same patches
+  if (!args->form_factor_cache.empty()) {
+    formfactor_cache = new FormFactorCache{args->form_factor_cache, FormFactorKey(*mesh, *args->mesh_data, sparse)};
+    if (formfactor_cache->load(num_faces, area, formfactors, sparse_formfactors)) {
+      std::cout << "form factors: loaded from " << formfactor_cache->getPath() << std::endl;
+      // (only dense ones stay in the cache's mapping)
+      if (formfactors == nullptr) {
+        delete formfactor_cache;
+        formfactor_cache = nullptr;
+      }
+    }
+  }
+
+  if (!hasFormFactors()) {
+    if (args->mesh_data->form_factor_method == FORM_FACTORS_HEMICUBE)
+      ComputeHemicubeFormFactors(sparse);
+    else
+      ComputeRaycastFormFactors(sparse);
+    if (formfactor_cache != nullptr) {
+      formfactor_cache->save(num_faces, area, formfactors, sparse_formfactors);
+      delete formfactor_cache;
+      formfactor_cache = nullptr;
+    }
+  }
+
+  if (sparse_formfactors != nullptr)
+    std::cout << "sparse form factors: " << sparse_formfactors->numBytes() / (1 << 20) << " MB (dense: "
+              << std::size_t(num_faces)*num_faces*sizeof(float) / (1 << 20) << " MB)" << std::endl;
+  findMaxUndistributed();
+}
+
+
+void Radiosity::ComputeRaycastFormFactors(bool sparse) {
   // =====================================
   // ASSIGNMENT:  COMPUTE THE FORM FACTORS
   // =====================================
+  const int numSamples{std::max(1, args->mesh_data->num_form_factor_samples)};
+  std::vector<Vec3f> centroids(num_faces), unitNormals(num_faces);
+  std::vector<std::array<Vertex*, 4>> vertices(num_faces);
+  std::vector<std::array<std::size_t, 2>> layouts(num_faces);
   for (int i{}; i < num_faces; ++i) {
-    for (int j{}; j < num_faces; ++j) {
-      if (i == j) {setFormFactor(i, j, 0); continue;}
-      const auto pi{mesh->getFace(i)->computeCentroid()}, pj{mesh->getFace(j)->computeCentroid()};
-      Hit h;
-      raytracer->CastRay({pj, pi - pj}, h, true);
-      if (h.getT() < 1) {setFormFactor(i, j, 0); continue;}
-      const auto icjc{pj - pi};
-      const auto r{icjc.Length()};
-      const auto
-        cosThetaI{normals[i].Dot3(icjc) / (normals[i].Length() * r)},
-        cosThetaJ{normals[j].Dot3(-icjc) / (normals[j].Length() * r)};
-      setFormFactor(i, j, std::abs(cosThetaI * cosThetaJ) / M_PI / (r * r) / getArea(i));
+    const Face *f{mesh->getFace(i)};
+    centroids[i] = f->computeCentroid();
+    unitNormals[i] = normals[i].Normalized();
+    vertices[i] = f->getVertices();
+    layouts[i] = f->sampleLayout(numSamples);
+  }
+
+  // the k-th of the sample points on patch i:  one per cell of its
+  // sampleLayout grid (cycling through them if the grid is short), or
+  // just the centroid, for one sample
+  auto samplePoint{[&] (int i, int k) {
+    if (numSamples == 1) return centroids[i];
+    const auto [ns, nt]{layouts[i]};
+    const std::size_t cell{k % (ns * nt)};
+    return randPoint(vertices[i], 1.f * (cell / nt) / ns, 1.f * (cell % nt) / nt, 1.f / ns, 1.f / nt);
+  }};
+
+  // G_ij, the integral over both patches of the point to point kernel
+  // cos(theta_i) cos(theta_j) / (pi r^2) times the visibility, by pairing
+  // up stratified samples on the two.  Each sample stands for a disc of
+  // area dA (Wallace et al.):  dividing by pi r^2 + dA instead keeps the
+  // kernel finite for samples close together on neighboring patches.
+  auto integrate{[&] (int i, int j, FormFactorSamples &s) -> double {
+    // (the same samples no matter how the rows are split among threads)
+    Sampler::Current().StartPixel(i, j, 0);
+    for (int k{}; k < numSamples; ++k) {
+      const Vec3f pi{samplePoint(i, k)};
+      s.xi[k] = pi.x(); s.yi[k] = pi.y(); s.zi[k] = pi.z();
+    }
+    for (int k{}; k < numSamples; ++k) {
+      // pair the samples on j with those on i in a random order
+      const int m{static_cast<int>(ArgParser::rand() * (k + 1))};
+      const Vec3f pj{samplePoint(j, k)};
+      s.xj[k] = s.xj[m]; s.yj[k] = s.yj[m]; s.zj[k] = s.zj[m];
+      s.xj[m] = pj.x(); s.yj[m] = pj.y(); s.zj[m] = pj.z();
+    }
+
+    const float dA{(getArea(i) + getArea(j)) / (2 * numSamples)};
+    const Vec3f &ni{unitNormals[i]}, &nj{unitNormals[j]};
+    const float nix{ni.x()}, niy{ni.y()}, niz{ni.z()}, njx{nj.x()}, njy{nj.y()}, njz{nj.z()};
+    for (int k{}; k < numSamples; ++k) {
+      const float dx{s.xj[k] - s.xi[k]}, dy{s.yj[k] - s.yi[k]}, dz{s.zj[k] - s.zi[k]};
+      const float r2{dx * dx + dy * dy + dz * dz};
+      // (both cosines times r)
+      const float cosI{nix * dx + niy * dy + niz * dz}, cosJ{njx * dx + njy * dy + njz * dz};
+      s.kernel[k] = std::abs(cosI * cosJ) / r2 / (static_cast<float>(M_PI) * r2 + dA);
+    }
+
+    // only the samples that would contribute need a visibility ray
+    double sum{};
+    for (int k{}; k < numSamples; ++k) {
+      if (!(s.kernel[k] > 0)) continue;
+      const Vec3f pi{s.xi[k], s.yi[k], s.zi[k]}, pj{s.xj[k], s.yj[k], s.zj[k]};
+      if (!raytracer->Occluded({pj, pi - pj}, 1, true))
+        sum += s.kernel[k];
     }
-    normalizeFormFactors(i);
+    return sum / numSamples * getArea(i) * getArea(j);
+  }};
+
+  // G_ij is the same both ways, so each pair i < j is integrated once,
+  // and then F_ij = G_ij / A_i, F_ji = G_ij / A_j (reciprocity:
+  // A_i F_ij = A_j F_ji).  Row i fills in the pairs with the later
+  // patches, so the rows shrink as i grows; the workers steal from each
+  // other to even that out.
+  if (!sparse) {
+    formfactors = new float[std::size_t(num_faces)*num_faces];
+    ParallelFor(num_faces, [&] (int i, int) {
+      FormFactorSamples samples{numSamples};
+      setFormFactor(i, i, 0);
+      for (int j{i + 1}; j < num_faces; ++j) {
+        const double g{integrate(i, j, samples)};
+        setFormFactor(i, j, g / getArea(i));
+        setFormFactor(j, i, g / getArea(j));
+      }
+    });
+    // (once every row is complete)
+    ParallelFor(num_faces, [&] (int i, int) {
+      normalizeFormFactors(i);
+    });
+  } else {
+    // keep just the pairs that see each other, without ever holding
+    // them all as floats:  each row is integrated twice (the samples are
+    // the same both times), to size the rows and then to fill them in.
+    // That's twice the rays of the dense matrix, which is why it's only
+    // used past SPARSE_FORM_FACTORS_MIN_PATCHES (or when asked for).
+    sparse_formfactors = new SparseFormFactors{num_faces, [&] (int i, const auto &entry) {
+      FormFactorSamples samples{numSamples};
+      for (int j{i + 1}; j < num_faces; ++j)
+        if (const double g{integrate(i, j, samples)}; g > 0)
+          entry(j, g);
+    }};
   }
-  findMaxUndistributed();
+}
+
+
+void Radiosity::ComputeHemicubeFormFactors(bool sparse) {
+  // the patches, by their index in the item buffer
+  std::vector<Hemicube::Quad> quads(num_faces);
+  std::vector<Vec3f> centroids(num_faces);
+  for (int i{}; i < num_faces; ++i) {
+    const Face *f{mesh->getFace(i)};
+    const int p{f->getRadiosityPatchIndex()};
+    const auto vs{f->getVertices()};
+    quads[p] = {vs[0]->get(), vs[1]->get(), vs[2]->get(), vs[3]->get()};
+    centroids[p] = f->computeCentroid();
+  }
+
+  // a whole row per hemicube, each thread with its own buffers
+  const int numThreads{NumWorkerThreads()};
+  std::vector<Hemicube> hemicubes(numThreads, Hemicube{args->mesh_data->hemicube_resolution});
+  std::vector<std::vector<float>> rows(numThreads, std::vector<float>(num_faces));
+  std::vector<SparseFormFactors::Row> sparseRows(sparse? num_faces : 0);
+  if (!sparse)
+    formfactors = new float[std::size_t(num_faces)*num_faces];
+  ParallelFor(num_faces, numThreads, [&] (int i, int t) {
+    auto &row{rows[t]};
+    std::fill(row.begin(), row.end(), 0.f);
+    hemicubes[t].computeRow(quads, i, centroids[i], normals[i], row);
+    // (the pixels that see nothing are lost)
+    if (sparse) {
+      // (quantized as soon as it's done, so the rows are never all kept
+      // as floats)
+      sparseRows[i] = SparseFormFactors::Quantize(row);
+    } else {
+      for (int j{}; j < num_faces; ++j)
+        setFormFactor(i, j, row[j]);
+      normalizeFormFactors(i);
+    }
+  });
+  if (sparse)
+    sparse_formfactors = new SparseFormFactors{std::move(sparseRows)};
 }
 
 
@@ -132,32 +321,147 @@ void Radiosity::ComputeFormFactors() {
 // ================================================================
 
 float Radiosity::Iterate() {
-  if (formfactors == nullptr)
+  if (args->mesh_data->hierarchical_radiosity)
+    return IterateHierarchical();
+  if (!hasFormFactors())
     ComputeFormFactors();
-  assert (formfactors != nullptr);
+  assert (hasFormFactors());
 
   // ==========================================
   // ASSIGNMENT:  IMPLEMENT RADIOSITY ALGORITHM
   // ==========================================
 
-  auto undistributed{this->undistributed[max_undistributed_patch]};
-  setUndistributed(max_undistributed_patch, {});
+  if (args->mesh_data->radiosity_solver != RADIOSITY_SHOOTING)
+    return IterateGathering();
+
+  // shoot from the patch with the most undistributed energy:  each
+  // patch i gets F_is of it, solving the same B = E + rho F B as the
+  // gathering solvers (with the rows normalized, F_si A_s / A_i would
+  // no longer be the same thing)
+  const int s{max_undistributed_patch};
+  const auto undistributed{this->undistributed[s]};
+  setUndistributed(s, {});
+  undistributed_heap.update(s, 0);
+  total_undistributed = 0;
   for (int i{}; i < num_faces; ++i) {
-    if (i == max_undistributed_patch) continue;
+    if (i == s) continue;
     const auto &rho{mesh->getFace(i)->getMaterial()->getDiffuseColor()};
-    const auto tp{undistributed * getFormFactor(i, max_undistributed_patch) * (getArea(max_undistributed_patch) / getArea(i))};
+    const auto tp{undistributed * getFormFactor(i, s)};
     const auto dRadiance{rho * tp};
     setUndistributed(i, getUndistributed(i) + dRadiance);
     setRadiance(i, getRadiance(i) + dRadiance);
     setAbsorbed(i, getAbsorbed(i) + (Vec3f{1, 1, 1} - rho) * tp);
+    // (the next patch to shoot comes off the heap, rather than a search)
+    const float energy = getUndistributed(i).Length() * getArea(i);
+    undistributed_heap.update(i, energy);
+    total_undistributed += energy;
   }
-  findMaxUndistributed();
+  max_undistributed_patch = undistributed_heap.top();
   // return the total light yet undistributed
   // (so we can decide when the solution has sufficiently converged)
   return total_undistributed;
 }
 
 
+// sum_j F_ij B_j over a dense row, 4 patches at a time:  one SSE lane
+// per patch, with the radiances split by channel (or one at a time,
+// without SSE)
+static Vec3f GatherRow(const float *row, const float *r, const float *g, const float *b, int n) {
+  int j{};
+#ifdef VECTORS_SSE
+  __m128 sr{_mm_setzero_ps()}, sg{_mm_setzero_ps()}, sb{_mm_setzero_ps()};
+  for (; j + 4 <= n; j += 4) {
+    const __m128 f{_mm_loadu_ps(row + j)};
+    sr = _mm_add_ps(sr, _mm_mul_ps(f, _mm_loadu_ps(r + j)));
+    sg = _mm_add_ps(sg, _mm_mul_ps(f, _mm_loadu_ps(g + j)));
+    sb = _mm_add_ps(sb, _mm_mul_ps(f, _mm_loadu_ps(b + j)));
+  }
+  alignas(16) float lanes[3][4];
+  _mm_store_ps(lanes[0], sr);
+  _mm_store_ps(lanes[1], sg);
+  _mm_store_ps(lanes[2], sb);
+  float sum[3];
+  for (int c{}; c < 3; ++c)
+    sum[c] = (lanes[c][0] + lanes[c][1]) + (lanes[c][2] + lanes[c][3]);
+#else
+  float sum[3]{};
+#endif
+  for (; j < n; ++j) {
+    sum[0] += row[j] * r[j];
+    sum[1] += row[j] * g[j];
+    sum[2] += row[j] * b[j];
+  }
+  return {sum[0], sum[1], sum[2]};
+}
+
+float Radiosity::IterateGathering() {
+  // the radiances by channel, for SIMD over the rows
+  std::vector<float> red(num_faces), green(num_faces), blue(num_faces);
+  for (int i{}; i < num_faces; ++i) {
+    red[i] = getRadiance(i).r();
+    green[i] = getRadiance(i).g();
+    blue[i] = getRadiance(i).b();
+  }
+  auto gather{[&] (int i) {
+    if (sparse_formfactors != nullptr)
+      return sparse_formfactors->gather(i, red.data(), green.data(), blue.data());
+    return GatherRow(formfactors + std::size_t(i)*num_faces, red.data(), green.data(), blue.data(), num_faces);
+  }};
+  // B_i = E_i + rho_i sum_j F_ij B_j, with the change left as undistributed
+  auto update{[&] (int i, const Vec3f &incoming) {
+    const Material &m{*mesh->getFace(i)->getMaterial()};
+    const Vec3f &rho{m.getDiffuseColor()};
+    const Vec3f b{m.getEmittedColor() + rho * incoming};
+    setUndistributed(i, b - getRadiance(i));
+    setAbsorbed(i, (Vec3f{1, 1, 1} - rho) * incoming);
+    setRadiance(i, b);
+  }};
+
+  if (args->mesh_data->radiosity_solver == RADIOSITY_JACOBI) {
+    // every patch from the last sweep's radiances, all at once
+    ParallelFor(num_faces, [&] (int i, int) {
+      update(i, gather(i));
+    });
+  } else {
+    // Gauss-Seidel:  each patch from the newest radiances, which
+    // converges in fewer sweeps, but one patch at a time
+    for (int i{}; i < num_faces; ++i) {
+      update(i, gather(i));
+      red[i] = getRadiance(i).r();
+      green[i] = getRadiance(i).g();
+      blue[i] = getRadiance(i).b();
+    }
+  }
+
+  findMaxUndistributed();
+  std::cout << "radiosity sweep " << ++num_sweeps << ": residual " << total_undistributed << std::endl;
+  return total_undistributed;
+}
+
+
+float Radiosity::IterateHierarchical() {
+  const std::size_t links{hierarchy != nullptr? hierarchy->numLinks() : 0};
+  if (hierarchy == nullptr)
+    hierarchy = new HierarchicalRadiosity{*mesh, *raytracer, args->mesh_data->hierarchical_epsilon};
+  hierarchy->Iterate();
+  if (hierarchy->numLinks() != links)
+    std::cout << "hierarchical radiosity: " << hierarchy->numLinks() << " links between "
+              << hierarchy->numElements() << " elements (form factors: "
+              << std::size_t(num_faces)*num_faces << ")" << std::endl;
+
+  // what's left undistributed is how much each patch changed
+  for (int i{}; i < num_faces; ++i) {
+    const Vec3f &b{hierarchy->getRadiance(i)};
+    const auto &rho{mesh->getFace(i)->getMaterial()->getDiffuseColor()};
+    setUndistributed(i, b - getRadiance(i));
+    setRadiance(i, b);
+    setAbsorbed(i, (Vec3f{1, 1, 1} - rho) * hierarchy->getIrradiance(i));
+  }
+  findMaxUndistributed();
+  return total_undistributed;
+}
+
+
 
 // =======================================================================================
 // HELPER FUNCTIONS FOR RENDERING
@@ -216,7 +520,7 @@ Vec3f Radiosity::setupHelperForColor(Face *f, int i, int j) {
   } else if (args->mesh_data->render_mode == RENDER_RADIANCE) {
     return getRadiance(i);
   } else if (args->mesh_data->render_mode == RENDER_FORM_FACTORS) {
-    if (formfactors == nullptr) ComputeFormFactors();
+    if (!hasFormFactors()) ComputeFormFactors();
     float scale = 0.2 * total_area/getArea(i);
     float factor = scale * getFormFactor(max_undistributed_patch,i);
     return {factor,factor,factor};
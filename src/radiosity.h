@@ -4,12 +4,16 @@
 #include <cassert>
 #include "argparser.h"
 #include "vectors.h"
+#include "form_factors.h"
+#include "indexed_heap.h"
 
 class Mesh;
 class Face;
 class Vertex;
 class RayTracer;
 class PhotonMapping;
+class HierarchicalRadiosity;
+class FormFactorCache;
 
 // ====================================================================
 // ====================================================================
@@ -33,11 +37,13 @@ public:
   // =========
   // ACCESSORS
   [[nodiscard]] Mesh* getMesh() const { return mesh; }
+  [[nodiscard]] bool hasFormFactors() const { return formfactors != nullptr || sparse_formfactors != nullptr; }
   [[nodiscard]] float getFormFactor(int i, int j) const {
     assert (i >= 0 && i < num_faces);
     assert (j >= 0 && j < num_faces);
+    if (sparse_formfactors != nullptr) return sparse_formfactors->get(i,j);
     assert (formfactors != nullptr);
-    return formfactors[i*num_faces+j]; }
+    return formfactors[std::size_t(i)*num_faces+j]; }
   [[nodiscard]] float getArea(int i) const {
     assert (i >= 0 && i < num_faces);
     return area[i]; }
@@ -54,11 +60,12 @@ public:
   // =========
   // MODIFIERS
   float Iterate();
+  // (only the dense matrix can be modified)
   void setFormFactor(int i, int j, float value) {
     assert (i >= 0 && i < num_faces);
     assert (j >= 0 && j < num_faces);
     assert (formfactors != nullptr);
-    formfactors[i*num_faces+j] = value; }
+    formfactors[std::size_t(i)*num_faces+j] = value; }
   void normalizeFormFactors(int i) {
     float sum = 0;
     int j;
@@ -86,6 +93,14 @@ public:
 
 private:
   Vec3f setupHelperForColor(Face *f, int i, int j);
+  // the form factor engines (see MeshData::form_factor_method), filling
+  // in either the dense or the sparse form factors
+  void ComputeRaycastFormFactors(bool sparse);
+  void ComputeHemicubeFormFactors(bool sparse);
+  // Iterate, for MeshData::hierarchical_radiosity, or for a gathering
+  // MeshData::radiosity_solver (one sweep over all of the patches)
+  float IterateHierarchical();
+  float IterateGathering();
 
   // ==============
   // REPRESENTATION
@@ -98,6 +113,13 @@ private:
   // a nxn matrix
   // F_i,j radiant energy leaving i arriving at j
   float *formfactors;
+  // or the same, with only the nonzero entries (for many patches)
+  SparseFormFactors *sparse_formfactors;
+  // the file the dense form factors are mapped from, if they were
+  // loaded from the cache (see ArgParser::form_factor_cache)
+  FormFactorCache *formfactor_cache;
+  // or neither, with hierarchical radiosity
+  HierarchicalRadiosity *hierarchy;
 
   // length n vectors
   float *area;
@@ -107,8 +129,10 @@ private:
   Vec3f *normals;
 
   int max_undistributed_patch;  // the patch with the most undistributed energy
+  IndexedMaxHeap undistributed_heap;  // all of the patches, by undistributed energy
   float total_undistributed;    // the total amount of undistributed light
   float total_area;             // the total area of the scene
+  int num_sweeps;               // of the gathering solvers, since Reset
 };
 
 // ====================================================================
@@ -0,0 +1,65 @@
+#ifndef _RAY_STATS_H_
+#define _RAY_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+
+// ====================================================================
+// ====================================================================
+// Counts of the rays cast by the ray tracer, by kind, for measuring
+// throughput.  Every thread counts into its own copy, so counting
+// costs no synchronization between render threads.  A thread's counts
+// are added to the shared totals when the thread exits.
+
+struct RayCounts {
+  std::uint64_t primary{};   // from the camera
+  std::uint64_t shadow{};    // towards a light sample
+  std::uint64_t indirect{};  // diffuse bounces and mirror reflections
+
+  [[nodiscard]] std::uint64_t total() const { return primary + shadow + indirect; }
+};
+
+class RayStats {
+
+public:
+
+  static void CountPrimary() { Local().counts.primary++; }
+  static void CountShadow() { Local().counts.shadow++; }
+  static void CountIndirect() { Local().counts.indirect++; }
+
+  // the counts of every thread that has exited, plus the calling
+  // thread's own.  (Only exact when no other thread is still counting,
+  // e.g. between renders.)
+  [[nodiscard]] static RayCounts Total() {
+    const RayCounts &mine{Local().counts};
+    return {primary + mine.primary, shadow + mine.shadow, indirect + mine.indirect};
+  }
+  // start counting from zero again
+  static void Reset() {
+    primary = shadow = indirect = 0;
+    Local().counts = {};
+  }
+
+private:
+
+  struct ThreadCounts {
+    ~ThreadCounts() {
+      primary += counts.primary;
+      shadow += counts.shadow;
+      indirect += counts.indirect;
+    }
+    RayCounts counts;
+  };
+  static ThreadCounts& Local() {
+    thread_local ThreadCounts local;
+    return local;
+  }
+
+  // REPRESENTATION
+  static inline std::atomic<std::uint64_t> primary{}, shadow{}, indirect{};
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
@@ -1,9 +1,10 @@
-#include <thread>
 #include <chrono>
+#include <algorithm>
 #include <type_traits>
 #include "raytracer.h"
 #include "material.h"
 #include "raytree.h"
+#include "raystats.h"
 #include "utils.h"
 #include "mesh.h"
 #include "meshdata.h"
@@ -11,6 +12,9 @@
 #include "primitive.h"
 #include "camera.h"
 #include "image.h"
+#include "parallel.h"
+#include "photon_mapping.h"
+#include "irradiance_cache.h"
 
 
 inline auto ToUnitSquare(std::tuple<double, double> p) {
@@ -25,23 +29,46 @@ inline auto ToUnitSquare(std::tuple<double, double> p) {
 
 
 // ===========================================================================
-// casts a single ray through the scene geometry and finds the closest hit
-bool RayTracer::CastRay(const Ray &ray, Hit &h, bool use_rasterized_patches) const {
-  bool answer = false;
+// CONSTRUCTOR
 
-  // intersect each of the quads
-  for (auto fp: mesh->getOriginalQuads())
-    answer |= fp->intersect(ray,h,args->mesh_data->intersect_backfacing);
+std::vector<Face*> ConcatFaces(const std::vector<Face*> &a, const std::vector<Face*> &b) {
+  std::vector<Face*> answer{a};
+  answer.insert(answer.end(), b.begin(), b.end());
+  return answer;
+}
 
-  // intersect each of the primitives (either the patches, or the original primitives)
-  if (use_rasterized_patches) {
-    for (auto fp: mesh->getRasterizedPrimitiveFaces())
-      answer |= fp->intersect(ray,h,args->mesh_data->intersect_backfacing);
-  } else {
-    for (auto pp: mesh->getPrimitives())
-      answer |= pp->intersect(ray,h);
+RayTracer::RayTracer(Mesh *m, ArgParser *a):
+  mesh{m},
+  args{a},
+  bvh{m->getOriginalQuads(), m->getPrimitives()},
+  patch_bvh{ConcatFaces(m->getOriginalQuads(), m->getRasterizedPrimitiveFaces()), {}},
+  light_sampler{m->getLights()},
+  irradiance_cache{},
+  render_to_a{true}
+{
+  const auto &md{*a->mesh_data};
+  if (md.irradiance_cache) {
+    // (the records' radii, relative to the size of the scene)
+    const BoundingBox &bbox{*m->getBoundingBox()};
+    const float size = bbox.maxDim();
+    irradiance_cache = new IrradianceCache{bbox, md.irradiance_cache_error, 0.01f * size, 0.5f * size};
   }
-  return answer;
+}
+
+RayTracer::~RayTracer() {
+  delete irradiance_cache;
+}
+
+
+// ===========================================================================
+// casts a single ray through the scene geometry and finds the closest hit
+bool RayTracer::CastRay(const Ray &ray, Hit &h, bool use_rasterized_patches) const {
+  // intersect the quads and either the patches or the original primitives
+  return (use_rasterized_patches? patch_bvh : bvh).intersect(ray,h,args->mesh_data->intersect_backfacing);
+}
+
+bool RayTracer::Occluded(const Ray &ray, float t_max, bool use_rasterized_patches) const {
+  return (use_rasterized_patches? patch_bvh : bvh).occluded(ray,t_max,args->mesh_data->intersect_backfacing);
 }
 
 
@@ -67,8 +94,28 @@ Vec3f HemisphereRandom(std::tuple<float, float> unitSqrPt, Vec3f normal) {
 }
 
 
+// Russian roulette:  once a path is past the first
+// russian_roulette_depth bounces, it continues only with probability q
+// following its throughput (the fraction of the light it still carries
+// back to the camera), and whatever survives is scaled by 1/q so the
+// estimate stays unbiased.  q is capped below 1, so even a path between
+// two perfect mirrors ends.  With unlimited bounces (num_bounces < 0)
+// this is the only thing that ends a path.
+bool RussianRoulette(const MeshData &md, int bounce, const Vec3f &throughput, float &survival) {
+  survival = 1;
+  if (!(md.russian_roulette || md.num_bounces < 0) || bounce < md.russian_roulette_depth)
+    return true;
+  const float q{std::min(std::max({throughput.r(), throughput.g(), throughput.b()}), 0.95f)};
+  if (!(ArgParser::rand() < q)) return false;
+  survival = 1 / q;
+  return true;
+}
+
+
 template<class F, bool Visualize>
-Vec3f RayTracer::shade(const Ray &ray, Hit &hit, const Material &m, int depth, F directIllum, std::bool_constant<Visualize>) const {
+Vec3f RayTracer::shade(const Ray &ray, Hit &hit, const Material &m, int depth, const Vec3f &throughput,
+                       bool count_emitted, F directIllum, std::bool_constant<Visualize>) const {
+  const auto &md{*args->mesh_data};
   const Vec3f &d{ray.getDirection()};
   const Vec3f &normal{hit.getNormal()};
   const Vec3f point{ray.pointAtParameter(hit.getT())};
@@ -77,40 +124,102 @@ Vec3f RayTracer::shade(const Ray &ray, Hit &hit, const Material &m, int depth, F
   Vec3f answer{};
 
   // direct illumination
-  for (const Face *f: mesh->getLights())
-    answer += directIllum(*f, point,
+  auto lightIllum{[&] (const LightSampler::Light &lt) {
+    return directIllum(*lt.face, point,
       [&] (const Vec3f &ptLtSample) {
         const float
           distSqr = ptLtSample.Dot3(ptLtSample),
           dist = std::sqrt(distSqr),
-          cosTheta = std::max(ptLtSample.Dot3(normal), 0.) / dist,
-          cosThetaP = std::max((-ptLtSample).Dot3(f->computeNormal()), 0.) / dist;
-        const Vec3f ltColor{f->getMaterial()->getEmittedColor()};
-        return cosTheta * cosThetaP / distSqr * f->getArea() * ltColor * m.brdf(hit, d, ptLtSample);
+          cosTheta = std::max(ptLtSample.Dot3(normal), 0.f) / dist,
+          cosThetaP = std::max((-ptLtSample).Dot3(lt.normal), 0.f) / dist;
+        return cosTheta * cosThetaP / distSqr * lt.area * lt.emitted * m.brdf(hit, d, ptLtSample);
       });
+  }};
+  if (md.sample_all_lights) {
+    for (const auto &lt: light_sampler.getLights())
+      answer += lightIllum(lt);
+  } else if (!light_sampler.empty()) {
+    // one light, chosen by power, stands in for all of them
+    const auto &lt{light_sampler.Pick()};
+    answer += 1 / lt.pdf * lightIllum(lt);
+  }
 
-  // indirect illumination
-  if (!depth) return answer;
-  auto dir{HemisphereRandom({static_cast<float>(ArgParser::rand()), static_cast<float>(ArgParser::rand())}, normal)};
-  const Ray r{point, dir};
-  Hit h{};
-  if (CastRay(r, h, false) && !h.getMaterial()->isEmitting()) {
-    if constexpr (Visualize) RayTree::AddReflectedSegment(r, 0, h.getT());
-    Vec3f ptLtSample{r.pointAtParameter(h.getT()) - point};
-    const float cosTheta = ptLtSample.Dot3(normal) / ptLtSample.Length();
-    answer +=
-      cosTheta * 2 * M_PI *
-      shade<F, Visualize>(r, h, *h.getMaterial(), depth - 1, directIllum) *
-      m.brdf(hit, d, ptLtSample);
+  // indirect illumination:  the diffuse part from the photon map
+  // (with gather_indirect), or else by following a random bounce
+  if (md.gather_indirect) {
+    // (as if it all arrived along the normal, which is only an
+    // approximation for glossy surfaces; and with progressive photon
+    // mapping, left to the photon passes)
+    const Vec3f brdf{m.brdf(hit, d, normal)};
+    if (photon_mapping->AddVisiblePoint(point, normal, d, throughput * brdf)) {
+      // (the visible point has it)
+    } else if (md.final_gather_samples > 0 && depth != 0 && depth == md.num_bounces) {
+      // final gather:  from the camera, the photons are gathered where
+      // a hemisphere of rays lands (cosine weighted:  pdf cos / pi),
+      // except for the caustics, which (with a caustic map) are then
+      // left out of what the rays see in mirrors
+      answer += brdf * photon_mapping->GatherCaustics(point, normal, d);
+      const bool count_caustics{!photon_mapping->hasCausticMap()};
+      for (int s{}; s < md.final_gather_samples; ++s) {
+        const Ray r{point, RandomDiffuseDirection(normal)};
+        Hit h{};
+        RayStats::CountIndirect();
+        if (!CastRay(r, h, false) || h.getMaterial()->isEmitting()) continue;
+        if constexpr (Visualize) RayTree::AddReflectedSegment(r, 0, h.getT());
+        const Vec3f weight{static_cast<float>(M_PI) / md.final_gather_samples * m.brdf(hit, d, r.getDirection())};
+        answer += weight * shade<F, Visualize>(r, h, *h.getMaterial(), depth - 1, throughput * weight,
+                                               count_caustics, directIllum);
+      }
+    } else if (md.final_gather_samples > 0) {
+      answer += brdf * photon_mapping->LookupIrradiance(point, normal, d);
+    } else {
+      answer += brdf * photon_mapping->GatherIndirect(point, normal, d);
+    }
+  }
+  float survival;
+  if (!depth || !RussianRoulette(md, md.num_bounces - depth, throughput, survival))
+    return answer;
+  if (!md.gather_indirect && irradiance_cache != nullptr && depth == md.num_bounces) {
+    // from the camera, the diffuse part from the irradiance cache (as
+    // if it all arrived along the normal, as with gather_indirect), with
+    // a new record wherever the ones already there aren't close enough
+    Vec3f irradiance;
+    if (!irradiance_cache->Lookup(point, normal, irradiance))
+      irradiance = irradiance_cache->AddRecord(point, normal, md.irradiance_cache_samples,
+        [&] (const Vec3f &dir, float &distance) -> Vec3f {
+          const Ray r{point, dir};
+          Hit h{};
+          RayStats::CountIndirect();
+          if (!CastRay(r, h, false)) return {};
+          distance = h.getT();
+          if (h.getMaterial()->isEmitting()) return {};
+          return shade<F, Visualize>(r, h, *h.getMaterial(), depth - 1, {1, 1, 1}, true, directIllum);
+        });
+    answer += survival * m.brdf(hit, d, normal) * irradiance;
+  } else if (!md.gather_indirect) {
+    auto dir{HemisphereRandom({static_cast<float>(ArgParser::rand()), static_cast<float>(ArgParser::rand())}, normal)};
+    const Ray r{point, dir};
+    Hit h{};
+    RayStats::CountIndirect();
+    if (CastRay(r, h, false) && !h.getMaterial()->isEmitting()) {
+      if constexpr (Visualize) RayTree::AddReflectedSegment(r, 0, h.getT());
+      Vec3f ptLtSample{r.pointAtParameter(h.getT()) - point};
+      const float cosTheta = ptLtSample.Dot3(normal) / ptLtSample.Length();
+      // (uniform over the hemisphere:  pdf 1 / 2pi)
+      const Vec3f weight{survival * cosTheta * 2 * static_cast<float>(M_PI) * m.brdf(hit, d, ptLtSample)};
+      answer += weight * shade<F, Visualize>(r, h, *h.getMaterial(), depth - 1, throughput * weight, true,
+                                             directIllum);
+    }
   }
 
   // mirror reflection
   if (m.getRoughness() == 0) {
     const Ray r{point, Reflection(d, normal)};
     Hit h{};
-    answer +=
-      m.getReflectiveColor() *
-      TraceRayImpl<F, Visualize>(r, h, depth - 1, directIllum);
+    RayStats::CountIndirect();
+    const Vec3f weight{survival * m.getReflectiveColor()};
+    answer += weight * TraceRayImpl<F, Visualize>(r, h, depth - 1, throughput * weight, count_emitted,
+                                                  directIllum);
     if constexpr (Visualize) RayTree::AddReflectedSegment(r, 0, h.getT());
   }
 
@@ -119,7 +228,8 @@ Vec3f RayTracer::shade(const Ray &ray, Hit &hit, const Material &m, int depth, F
 
 
 template<class F, bool Visualize>
-Vec3f RayTracer::TraceRayImpl(const Ray &ray, Hit &hit, int depth, F directIllum, std::bool_constant<Visualize>) const {
+Vec3f RayTracer::TraceRayImpl(const Ray &ray, Hit &hit, int depth, const Vec3f &throughput,
+                              bool count_emitted, F directIllum, std::bool_constant<Visualize>) const {
   hit = {};
   // First cast a ray and see if we hit anything.
   // if there is no intersection, simply return the background color
@@ -134,8 +244,8 @@ Vec3f RayTracer::TraceRayImpl(const Ray &ray, Hit &hit, int depth, F directIllum
   const Material *m{hit.getMaterial()};
   assert (m != nullptr);
   if (m->isEmitting())
-    return m->getEmittedColor();
-  return shade<F, Visualize>(ray, hit, *m, depth, directIllum);
+    return count_emitted? m->getEmittedColor() : Vec3f{};
+  return shade<F, Visualize>(ray, hit, *m, depth, throughput, count_emitted, directIllum);
 }
 
 
@@ -145,10 +255,15 @@ Vec3f RayTracer::TraceRay(const Ray &ray, Hit &hit, int depth) const {
 
   // "shadow ray"
   auto directIllum{[&] (const Ray &r, auto shadeLocal) {
-    Hit block{};
-    CastRay(r, block, false);
-    if constexpr (Visualize) RayTree::AddShadowSegment(r, 0, block.getT());
-    return block.getT() > 1 - EPSILON? shadeLocal(r.getDirection()) : Vec3f{};
+    RayStats::CountShadow();
+    if constexpr (Visualize) {
+      // the ray tree needs to know where the shadow ray stops
+      Hit block{};
+      CastRay(r, block, false);
+      RayTree::AddShadowSegment(r, 0, block.getT());
+      return block.getT() > 1 - EPSILON? shadeLocal(r.getDirection()) : Vec3f{};
+    }
+    return Occluded(r, 1 - EPSILON, false)? Vec3f{} : shadeLocal(r.getDirection());
   }};
 
   std::bool_constant<Visualize> vis;
@@ -156,7 +271,7 @@ Vec3f RayTracer::TraceRay(const Ray &ray, Hit &hit, int depth) const {
   // samples and antialiasing samples
   switch (int sSamp{md.num_shadow_samples}; sSamp * md.num_antialias_samples) {
   case 0:
-  return TraceRayImpl(ray, hit, depth,
+  return TraceRayImpl(ray, hit, depth, {1, 1, 1}, true,
     [] (const Face &lt, const Vec3f &pt, auto shadeLocal) { // no shadows considered
       const auto ptLtC{lt.computeCentroid() - pt};
       if constexpr (Visualize) RayTree::AddShadowSegment({pt, ptLtC}, 0, 1);
@@ -164,52 +279,61 @@ Vec3f RayTracer::TraceRay(const Ray &ray, Hit &hit, int depth) const {
     }, vis);
 
   case 1:
-  return TraceRayImpl(ray, hit, depth,
+  return TraceRayImpl(ray, hit, depth, {1, 1, 1}, true,
     [&] (const Face &lt, const Vec3f &pt, auto shadeLocal) { // "decay" to hard shadows
       return directIllum({pt, lt.computeCentroid() - pt}, shadeLocal);
     }, vis);
 
   default:
-  return TraceRayImpl(ray, hit, depth,
+  return TraceRayImpl(ray, hit, depth, {1, 1, 1}, true,
     [&] (const Face &lt, const Vec3f &pt, auto shadeLocal) { // soft shadows
-      Vec3f directIllumSum{};
+      Vec3d directIllumSum{};
       const auto vs{lt.getVertices()};
       const auto sampleN{lt.sampleLayout(sSamp)};
       const float scaleI{1.f / sampleN[0]}, scaleJ{1.f / sampleN[1]};
       for (std::size_t i{}; i < sampleN[0]; ++i)
         for (std::size_t j{}; j < sampleN[1]; ++j) {
           const float offsetI{1.f * i / sampleN[0]}, offsetJ{1.f * j / sampleN[1]};
-          directIllumSum +=
-            directIllum({pt, randPoint(vs, offsetI, offsetJ, scaleI, scaleJ) - pt}, shadeLocal);
+          directIllumSum += Vec3d{
+            directIllum({pt, randPoint(vs, offsetI, offsetJ, scaleI, scaleJ) - pt}, shadeLocal)};
         }
-      return 1. / (sampleN[0] * sampleN[1]) * directIllumSum;
+      return Vec3f{1. / (sampleN[0] * sampleN[1]) * directIllumSum};
     }, vis);
   }
 }
 
 
+int RayTracer::samplesPerPixel() const {
+  const int aa{static_cast<int>(std::sqrt(args->mesh_data->num_antialias_samples))};
+  return aa * aa;
+}
+
+
 // camera sampling, including antialiasing
 // trace a ray through pixel (i,j) of the image an return the radiance
 template<bool Visualize>
 Vec3f RayTracer::renderPixel(double i, double j) const {
   const auto &md{*args->mesh_data};
-  const auto aa{static_cast<std::size_t>(std::sqrt(md.num_antialias_samples))};
+  const auto aa{static_cast<std::size_t>(std::sqrt(samplesPerPixel()))};
   const auto
     ds{1. / aa},
     i0{i + ds / 2},
     j0{j + ds / 2};
 
-  Vec3f sum{};
+  // accumulate the samples in double precision
+  Vec3d sum{};
   for (std::size_t si{}; si < aa; ++si)
     for (std::size_t sj{}; sj < aa; ++sj) {
+      Sampler::Current().StartPixel(i, j, si * aa + sj);
       const auto [x, y]{ToUnitSquare({i0 + ds * si, j0 + ds * sj})};
       const Ray r = args->mesh->camera->generateRay(x,y);
       Hit hit;
-      sum += TraceRay<Visualize>(r, hit, md.num_bounces);
+      RayStats::CountPrimary();
+      sum += Vec3d{TraceRay<Visualize>(r, hit, md.num_bounces)};
       if constexpr (Visualize) RayTree::AddMainSegment(r, 0, hit.getT());
     }
 
-  return 1. / (aa * aa) * sum;
+  return Vec3f{1. / (aa * aa) * sum};
 }
 
 Vec3f VisualizeTraceRay(double i, double j) {
@@ -325,46 +449,114 @@ void RayTracer::packMesh(float* &current) {
 }
 
 
-void RayTracer::renderToFile(const std::filesystem::path &fPath) const {
-  std::cout << "Starting raytracing render..." << std::endl;
-  Image img{args->mesh_data->width, args->mesh_data->height};
+// position of cell (x,y) along the Hilbert curve through an n by n grid
+// (n a power of 2)
+int HilbertIndex(int n, int x, int y) {
+  int d{};
+  for (int s{n / 2}; s > 0; s /= 2) {
+    const int rx{(x & s) > 0}, ry{(y & s) > 0};
+    d += s * s * ((3 * rx) ^ ry);
+    // rotate the quadrant
+    if (ry == 0) {
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      std::swap(x, y);
+    }
+  }
+  return d;
+}
+
+
+void RayTracer::renderImage(Image &img, int numThreads) const {
+  auto setPixel{[&] (int i, int j, const Vec3f &p) {
+    auto viewTransform{[] (float x) -> std::uint8_t {
+      return std::round(255 * std::min(linear_to_srgb(x), 1.f));
+    }};
+    img.SetPixel(i, j,
+      {viewTransform(p.r()), viewTransform(p.g()), viewTransform(p.b())});
+  }};
+
+  // progressive photon mapping traces the pixels itself
+  if (args->mesh_data->progressive_photon_passes > 0) {
+    const std::vector<Vec3f> radiance{
+      photon_mapping->RenderProgressive(img.Width(), img.Height(), samplesPerPixel())};
+    for (int j{}; j < img.Height(); ++j)
+      for (int i{}; i < img.Width(); ++i)
+        setPixel(i, j, radiance[std::size_t(j) * img.Width() + i]);
+    return;
+  }
+
+  // seed the irradiance cache from a coarse grid of the pixels (what
+  // they return is thrown away)
+  if (irradiance_cache != nullptr && args->mesh_data->irradiance_cache_prepass > 0) {
+    const int spacing{args->mesh_data->irradiance_cache_prepass};
+    const int width{(img.Width() + spacing - 1) / spacing};
+    const int height{(img.Height() + spacing - 1) / spacing};
+    ParallelFor(height, numThreads, [&] (int j, int) {
+      for (int i{}; i < width; ++i)
+        (void)renderPixel(std::min(i * spacing + spacing / 2, img.Width() - 1),
+                          std::min(j * spacing + spacing / 2, img.Height() - 1));
+    });
+  }
 
   auto renderBlock{[&] (std::tuple<int, int> wRange, std::tuple<int, int> hRange) {
     const auto [wStart, wEnd]{wRange};
     const auto [hStart, hEnd]{hRange};
     for (int i{wStart}; i < wEnd; ++i)
-      for (int j{hStart}; j < hEnd; ++j) {
-        const auto p{renderPixel(i, j)};
-        auto viewTransform{[] (float x) -> std::uint8_t {
-          return std::round(255 * std::min(linear_to_srgb(x), 1.f));
-        }};
-        img.SetPixel(i, j,
-          {viewTransform(p.r()), viewTransform(p.g()), viewTransform(p.b())});
-      }
+      for (int j{hStart}; j < hEnd; ++j)
+        setPixel(i, j, renderPixel(i, j));
   }};
-  static constexpr int blockSize{128};
-  using namespace std::chrono;
 
+  // small tiles, visited along a Hilbert curve so that consecutive
+  // tiles (mostly taken by the same worker) are close together
+  static constexpr int tileSize{16};
+  const int tilesX{(img.Width() + tileSize - 1) / tileSize};
+  const int tilesY{(img.Height() + tileSize - 1) / tileSize};
+  int curveSize{1};
+  while (curveSize < std::max(tilesX, tilesY)) curveSize *= 2;
+  std::vector<std::tuple<int, int>> tiles;
+  tiles.reserve(tilesX * tilesY);
+  for (int i{}; i < tilesX; ++i)
+    for (int j{}; j < tilesY; ++j)
+      tiles.emplace_back(i, j);
+  std::sort(tiles.begin(), tiles.end(), [&] (const auto &a, const auto &b) {
+    return HilbertIndex(curveSize, std::get<0>(a), std::get<1>(a)) <
+      HilbertIndex(curveSize, std::get<0>(b), std::get<1>(b));
+  });
+
+  ParallelFor(tiles.size(), numThreads, [&] (int t, int) {
+    const int i{std::get<0>(tiles[t]) * tileSize}, j{std::get<1>(tiles[t]) * tileSize};
+    renderBlock(
+      {i, std::min(i + tileSize, img.Width())},
+      {j, std::min(j + tileSize, img.Height())}
+    );
+  });
+}
+
+
+bool RayTracer::renderToFile(const std::filesystem::path &fPath) const {
+  std::cout << "Starting raytracing render..." << std::endl;
+  Image img{args->mesh_data->width, args->mesh_data->height};
+
+  using namespace std::chrono;
+  const int numThreads{NumWorkerThreads()};
   auto tStart{steady_clock::now()};
-  std::vector<std::thread> ts;
-  ts.reserve(std::ceil(1. * img.Width() / blockSize) * std::ceil(1. * img.Height() / blockSize));
-  for (int i{}; i < img.Width(); i += blockSize)
-    for (int j{}; j < img.Height(); j += blockSize)
-      ts.emplace_back([&, i, j] () {renderBlock(
-        {i, std::min(i + blockSize, img.Width())},
-        {j, std::min(j + blockSize, img.Height())}
-      );});
-  for (auto &t: ts)
-    t.join();
+  renderImage(img, numThreads);
   auto renderTime{steady_clock::now() - tStart};
 
   auto p{std::cout.precision(2)};
   (std::cout << "Render completed in " << std::fixed
-    << duration_cast<duration<float>>(renderTime).count() << " seconds." << std::endl
+    << duration_cast<duration<float>>(renderTime).count() << " seconds on "
+    << numThreads << " thread" << (numThreads == 1? "." : "s.") << std::endl
     << std::defaultfloat).precision(p);
+  if (irradiance_cache != nullptr)
+    std::cout << "The irradiance cache has " << irradiance_cache->numRecords() << " records." << std::endl;
 
-  img.Save(fPath.string());
+  if (!img.Save(fPath.string())) return false;
   std::cout << "Image saved as " << fPath << std::endl;
+  return true;
 }
 
 // ===========================================================================
@@ -5,11 +5,15 @@
 #include <filesystem>
 #include "ray.h"
 #include "hit.h"
+#include "bvh.h"
+#include "light_sampler.h"
 
 class Mesh;
 class ArgParser;
 class Radiosity;
 class PhotonMapping;
+class IrradianceCache;
+class Image;
 
 struct Pixel {
   Vec3f v1,v2,v3,v4;
@@ -24,12 +28,22 @@ struct Pixel {
 class RayTracer {
 public:
   // CONSTRUCTOR & DESTRUCTOR
-  RayTracer(Mesh *m, ArgParser *a): mesh{m}, args{a}, render_to_a{true} {}
+  RayTracer(Mesh *m, ArgParser *a);
+  ~RayTracer();
+  RayTracer(const RayTracer&) = delete;
+  RayTracer& operator=(const RayTracer&) = delete;
 
   [[nodiscard]] std::size_t triCount() const;
   void packMesh(float* &current);
-  void renderToFile(const std::filesystem::path &) const;
+  // traces every pixel of img (sized to the MeshData width and height)
+  // on numThreads threads
+  void renderImage(Image &img, int numThreads) const;
+  // returns false if the image could not be saved
+  bool renderToFile(const std::filesystem::path &) const;
   template<bool Visualize = false> Vec3f renderPixel(double i, double j) const;
+  // the camera samples renderPixel averages (the largest square number
+  // of antialias samples)
+  [[nodiscard]] int samplesPerPixel() const;
   int DrawPixel();
 
   // set access to the other modules for hybrid rendering options
@@ -38,13 +52,22 @@ public:
 
   // casts a single ray through the scene geometry and finds the closest hit
   bool CastRay(const Ray &ray, Hit &h, bool use_rasterized_patches) const;
+  // is anything hit along the ray before t_max?  stops at the first
+  // blocker and does not compute the hit material, normal, or texture
+  [[nodiscard]] bool Occluded(const Ray &ray, float t_max, bool use_rasterized_patches) const;
   template<bool Visualize = false> Vec3f TraceRay(const Ray &, Hit &, int depth = 0) const;
 
 private:
+  // throughput is the fraction of the light leaving the hit point
+  // that makes it back to the camera along the path so far;
+  // count_emitted is false where the lights seen from here in mirrors
+  // are already counted (by the caustic map, for a final gather)
   template<class F, bool Visualize> Vec3f shade(const Ray &, Hit &,
-    const Material &m, int depth, F directIllum, std::bool_constant<Visualize> = {}) const;
+    const Material &m, int depth, const Vec3f &throughput, bool count_emitted, F directIllum,
+    std::bool_constant<Visualize> = {}) const;
   template<class F, bool Visualize> Vec3f TraceRayImpl(const Ray &, Hit &,
-    int depth, F directIllum, std::bool_constant<Visualize> = {}) const;
+    int depth, const Vec3f &throughput, bool count_emitted, F directIllum,
+    std::bool_constant<Visualize> = {}) const;
 
   // REPRESENTATION
   Mesh *mesh;
@@ -52,6 +75,17 @@ private:
   Radiosity *radiosity;
   PhotonMapping *photon_mapping;
 
+  // acceleration structures for CastRay, built once after the mesh is
+  // loaded: the original quads with either the original primitives or
+  // their rasterized patches
+  BVH bvh;
+  BVH patch_bvh;
+  // picks the light to sample for direct illumination
+  LightSampler light_sampler;
+  // (with the irradiance_cache option, filled in as the pixels are
+  // traced)
+  IrradianceCache *irradiance_cache;
+
 public:
   bool render_to_a;
   std::vector<Pixel> pixels_a;
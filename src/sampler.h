@@ -0,0 +1,84 @@
+#ifndef _SAMPLER_H_
+#define _SAMPLER_H_
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+
+// ====================================================================
+// ====================================================================
+// A small, fast random number generator (PCG32, see pcg-random.org)
+// used for all of the Monte Carlo sampling.  Every thread owns its
+// own sampler, so there is no shared state between render threads.
+//
+// Before tracing a camera sample, the renderer restarts the calling
+// thread's sampler at (pixel, sample index).  The n-th number drawn
+// after that is sampling dimension n, so each value depends only on
+// (seed, pixel, sample index, dimension) and a render with a fixed
+// seed is reproducible no matter how the work is split among threads.
+
+class Sampler {
+
+public:
+
+  // CONSTRUCTOR
+  explicit Sampler(std::uint64_t sequence) { Seed(seed, sequence); }
+
+  // the sampler of the calling thread.  Threads that never start a
+  // pixel (photon tracing, radiosity) each get a different stream.
+  static Sampler& Current() {
+    static std::atomic<std::uint64_t> num_threads{};
+    thread_local Sampler sampler{num_threads++};
+    return sampler;
+  }
+
+  // the seed shared by all of the samplers
+  static void SetSeed(std::uint64_t s) { seed = s; }
+  [[nodiscard]] static std::uint64_t GetSeed() { return seed; }
+
+  // restart the stream at a particular sample of pixel (i,j)
+  void StartPixel(double i, double j, int sample) {
+    const auto x{static_cast<std::uint32_t>(static_cast<std::int32_t>(std::floor(i)))};
+    const auto y{static_cast<std::uint32_t>(static_cast<std::int32_t>(std::floor(j)))};
+    Seed(Mix(seed ^ Mix((std::uint64_t{x} << 32) | y)), static_cast<std::uint64_t>(sample));
+  }
+
+  // uniformly distributed in [0,2^32)
+  std::uint32_t NextUInt() {
+    const std::uint64_t old{state};
+    state = old * 6364136223846793005ULL + inc;
+    const auto xorshifted{static_cast<std::uint32_t>(((old >> 18) ^ old) >> 27)};
+    const auto rot{static_cast<std::uint32_t>(old >> 59)};
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+  }
+  // uniformly distributed in [0,1)
+  double Get1D() { return NextUInt() * (1. / 4294967296.); }
+
+private:
+
+  // HELPER FUNCTIONS
+  void Seed(std::uint64_t initstate, std::uint64_t sequence) {
+    state = 0;
+    inc = (sequence << 1) | 1;
+    NextUInt();
+    state += initstate;
+    NextUInt();
+  }
+  // the splitmix64 finalizer, to spread nearby pixels far apart
+  static std::uint64_t Mix(std::uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // REPRESENTATION
+  std::uint64_t state;
+  std::uint64_t inc;
+
+  static inline std::uint64_t seed{};
+};
+
+// ====================================================================
+// ====================================================================
+
+#endif
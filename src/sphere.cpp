@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "utils.h"
 #include "material.h"
 #include "argparser.h"
@@ -7,6 +8,7 @@
 #include "meshdata.h"
 #include "ray.h"
 #include "hit.h"
+#include "boundingbox.h"
 
 
 
@@ -20,27 +22,55 @@ bool Sphere::intersect(const Ray &r, Hit &h) const {
   // ASSIGNMENT:  IMPLEMENT SPHERE INTERSECTION
   // ==========================================
 
-  // Solve for t: at^2 + bt + c = 0
-  const auto &d{r.getDirection()};
-  const auto &co{r.getOrigin() - center};
-  const double
+  // Solve for t: at^2 + 2bt + c = 0.  In single precision, take the
+  // root whose terms don't cancel and get the other one from t0*t1 = c/a,
+  // otherwise the root near 0 (e.g. a shadow ray leaving the sphere)
+  // loses all of its digits
+  const Vec3f &d{r.getDirection()};
+  const Vec3f co{r.getOrigin() - center};
+  const float
     a{d.Dot3(d)},
-    b{2 * co.Dot3(d)},
+    b{co.Dot3(d)},
     c{co.Dot3(co) - radius * radius},
 
-    discrim{b * b - 4 * a * c},
-    rtDiscrim{std::sqrt(discrim)},
-    t_[]{(-b + rtDiscrim) / (2 * a), (-b - rtDiscrim) / (2 * a)};
+    discrim{b * b - a * c};
+  if (discrim < 0) return false;
+  const float q{-(b + std::copysign(std::sqrt(discrim), b))};
+  const auto [t_near, t_far]{std::minmax({q / a, c / q})};
 
   if (const auto tPrev{h.getT()};
-      !((t_[0] > EPSILON) & (t_[1] < tPrev) & ((t_[1] > EPSILON) | (t_[0] < tPrev))))
+      !((t_far > EPSILON) & (t_near < tPrev) & ((t_near > EPSILON) | (t_far < tPrev))))
     return false;
-  const auto t{t_[t_[1] > EPSILON]};
+  const float t{t_near > EPSILON? t_near : t_far};
   h.set(t, material, (r.pointAtParameter(t) - center).Normalized());
   return true;
 }
 
 
+bool Sphere::occludes(const Ray &r, float t_max) const {
+  // same as intersect above
+  const Vec3f &d{r.getDirection()};
+  const Vec3f co{r.getOrigin() - center};
+  const float
+    a{d.Dot3(d)},
+    b{co.Dot3(d)},
+    c{co.Dot3(co) - radius * radius},
+
+    discrim{b * b - a * c};
+  if (discrim < 0) return false;
+  const float q{-(b + std::copysign(std::sqrt(discrim), b))};
+  const float t0{q / a}, t1{c / q};
+
+  return (t0 > EPSILON && t0 < t_max) || (t1 > EPSILON && t1 < t_max);
+}
+
+
+BoundingBox Sphere::getBoundingBox() const {
+  const Vec3f r{radius,radius,radius};
+  return {center-r,center+r};
+}
+
+
 // helper function to place a grid of points on the sphere
 Vec3f ComputeSpherePoint(float s, float t, const Vec3f &center, float radius) {
   float angle = 2*M_PI*s;
@@ -18,6 +18,8 @@ public:
 
   // for ray tracing
   [[nodiscard]] virtual bool intersect(const Ray &r, Hit &h) const;
+  [[nodiscard]] bool occludes(const Ray &r, float t_max) const;
+  [[nodiscard]] BoundingBox getBoundingBox() const;
 
   // for OpenGL rendering & radiosity
   void addRasterizedFaces(Mesh *m, ArgParser *args);
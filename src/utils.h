@@ -90,7 +90,7 @@ inline Vec3f RandomUnitVector() {
 }
 
 // compute the perfect mirror direction
-constexpr Vec3f Reflection(const Vec3f &incoming, const Vec3f &normal) {
+inline Vec3f Reflection(const Vec3f &incoming, const Vec3f &normal) {
   return incoming - incoming.Dot3(normal) * 2 * normal;
 }
 
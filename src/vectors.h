@@ -13,118 +13,173 @@
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
+#include <type_traits>
+
+// SSE is available on every x86-64 target (define VECTORS_NO_SIMD to
+// use the portable code instead).  With -march=native (or /arch:AVX)
+// the compiler also uses the AVX encodings of these instructions.
+#if !defined(VECTORS_NO_SIMD) && (defined(__SSE__) || defined(_M_X64))
+#define VECTORS_SSE
+#include <xmmintrin.h>
+#endif
 
 class Matrix;
 
 // ====================================================================
 // ====================================================================
+// A 3 component vector, in single (Vec3f) or double (Vec3d) precision.
+//
+// Vec3f is the type used for all of the geometry, rays, and colors.
+// Its components are stored as floats padded out to 4 lanes (the 4th
+// is always 0) and aligned to 16 bytes, so that a vector fits in one
+// SSE register and every operation below is a handful of instructions.
+// Vec3d is available for the few places that sum up many small
+// contributions and need the precision.
 
-class Vec3f {
+template<class T>
+class alignas(4 * sizeof(T)) Vec3 {
 
 public:
 
   // -----------------------------------------------
   // CONSTRUCTORS, ASSIGNMENT OPERATOR, & DESTRUCTOR
-  constexpr Vec3f() noexcept : data{} {}
-  constexpr Vec3f(const Vec3f &V) noexcept : data{V.data[0], V.data[1], V.data[2]} {}
-  constexpr Vec3f(double d0, double d1, double d2) noexcept : data{d0, d1, d2} {}
-  constexpr Vec3f& operator=(const Vec3f &V) noexcept {
-    data[0] = V.data[0];
-    data[1] = V.data[1];
-    data[2] = V.data[2];
-    return *this; }
+  constexpr Vec3() noexcept : data{} {}
+  constexpr Vec3(const Vec3 &V) noexcept = default;
+  constexpr Vec3(double d0, double d1, double d2) noexcept : data{} {
+#ifdef VECTORS_SSE
+    if constexpr (use_sse) {
+      Store(_mm_setr_ps(d0, d1, d2, 0));
+      return; }
+#endif
+    data[0] = static_cast<T>(d0);
+    data[1] = static_cast<T>(d1);
+    data[2] = static_cast<T>(d2); }
+  // converting between precisions is explicit
+  template<class U>
+  constexpr explicit Vec3(const Vec3<U> &V) noexcept : Vec3{V.x(), V.y(), V.z()} {}
+  constexpr Vec3& operator=(const Vec3 &V) noexcept = default;
 
   // ----------------------------
   // SIMPLE ACCESSORS & MODIFIERS
-  [[nodiscard]] double operator[](int i) const { 
+  [[nodiscard]] T operator[](int i) const { 
     assert (i >= 0 && i < 3); 
     return data[i]; }
-  [[nodiscard]] constexpr double x() const noexcept { return data[0]; }
-  [[nodiscard]] constexpr double y() const noexcept { return data[1]; }
-  [[nodiscard]] constexpr double z() const noexcept { return data[2]; }
-  [[nodiscard]] constexpr double r() const noexcept { return data[0]; }
-  [[nodiscard]] constexpr double g() const noexcept { return data[1]; }
-  [[nodiscard]] constexpr double b() const noexcept { return data[2]; }
-  constexpr void setx(double x) noexcept { data[0]=x; }
-  constexpr void sety(double y) noexcept { data[1]=y; }
-  constexpr void setz(double z) noexcept { data[2]=z; }
+  [[nodiscard]] constexpr T x() const noexcept { return data[0]; }
+  [[nodiscard]] constexpr T y() const noexcept { return data[1]; }
+  [[nodiscard]] constexpr T z() const noexcept { return data[2]; }
+  [[nodiscard]] constexpr T r() const noexcept { return data[0]; }
+  [[nodiscard]] constexpr T g() const noexcept { return data[1]; }
+  [[nodiscard]] constexpr T b() const noexcept { return data[2]; }
+  constexpr void setx(double x) noexcept { data[0] = static_cast<T>(x); }
+  constexpr void sety(double y) noexcept { data[1] = static_cast<T>(y); }
+  constexpr void setz(double z) noexcept { data[2] = static_cast<T>(z); }
   constexpr void set(double d0, double d1, double d2) noexcept {
-    data[0] = d0;
-    data[1] = d1;
-    data[2] = d2; }
+    *this = {d0, d1, d2}; }
 
   // ----------------
   // EQUALITY TESTING 
-  constexpr bool operator==(const Vec3f &V) const noexcept {
+  constexpr bool operator==(const Vec3 &V) const noexcept {
     return data[0] == V.data[0] &&
 	    data[1] == V.data[1] &&
 	    data[2] == V.data[2]; }
-  constexpr bool operator!=(const Vec3f &V) const noexcept {
+  constexpr bool operator!=(const Vec3 &V) const noexcept {
     return data[0] != V.data[0] ||
 	    data[1] != V.data[1] ||
 	    data[2] != V.data[2]; }
 
   // ------------------------
   // COMMON VECTOR OPERATIONS
-  [[nodiscard]] double Length() const noexcept {
-    return sqrt(data[0]*data[0]+data[1]*data[1]+data[2]*data[2]); }
+  [[nodiscard]] T Length() const noexcept {
+    return std::sqrt(Dot3(*this)); }
   void Normalize() noexcept {
     if (auto len{Length()}) (*this) /= len; }
-  [[nodiscard]] Vec3f Normalized() const noexcept {
-    if (auto len{Length()}) return {data[0] / len, data[1] / len, data[2] / len};
+  [[nodiscard]] Vec3 Normalized() const noexcept {
+    if (auto len{Length()}) return *this / len;
     return *this; }
   constexpr void Negate() noexcept { (*this) *= -1; }
-  [[nodiscard]] constexpr double Dot3(const Vec3f &V) const noexcept {
+  [[nodiscard]] constexpr T Dot3(const Vec3 &V) const noexcept {
+#ifdef VECTORS_SSE
+    if constexpr (use_sse) {
+      // the 4th lanes are 0, so add up all 4 products
+      const __m128 p{_mm_mul_ps(Load(), V.Load())};
+      const __m128 s{_mm_add_ps(p, _mm_movehl_ps(p, p))};
+      return _mm_cvtss_f32(_mm_add_ss(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1,1,1,1)))); }
+#endif
     return data[0] * V.data[0] +
       data[1] * V.data[1] +
       data[2] * V.data[2] ; }
-  static void Cross3(Vec3f &c, const Vec3f &v1, const Vec3f &v2) noexcept {
-    double x = v1.data[1]*v2.data[2] - v1.data[2]*v2.data[1];
-    double y = v1.data[2]*v2.data[0] - v1.data[0]*v2.data[2];
-    double z = v1.data[0]*v2.data[1] - v1.data[1]*v2.data[0];
+  static void Cross3(Vec3 &c, const Vec3 &v1, const Vec3 &v2) noexcept {
+#ifdef VECTORS_SSE
+    if constexpr (use_sse) {
+      // v1 x v2 = (v1 * v2.yzx - v1.yzx * v2).yzx
+      const __m128 a{v1.Load()}, b{v2.Load()};
+      const __m128 a_yzx{_mm_shuffle_ps(a, a, _MM_SHUFFLE(3,0,2,1))};
+      const __m128 b_yzx{_mm_shuffle_ps(b, b, _MM_SHUFFLE(3,0,2,1))};
+      const __m128 d{_mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b))};
+      c.Store(_mm_shuffle_ps(d, d, _MM_SHUFFLE(3,0,2,1)));
+      return; }
+#endif
+    T x = v1.data[1]*v2.data[2] - v1.data[2]*v2.data[1];
+    T y = v1.data[2]*v2.data[0] - v1.data[0]*v2.data[2];
+    T z = v1.data[0]*v2.data[1] - v1.data[1]*v2.data[0];
     c.data[0] = x; c.data[1] = y; c.data[2] = z; }
 
   // ---------------------
   // VECTOR MATH OPERATORS
-  constexpr Vec3f& operator+=(const Vec3f &V) noexcept {
-    data[0] += V.data[0];
-    data[1] += V.data[1];
-    data[2] += V.data[2];
+  constexpr Vec3& operator+=(const Vec3 &V) noexcept {
+#ifdef VECTORS_SSE
+    if constexpr (use_sse) {
+      Store(_mm_add_ps(Load(), V.Load()));
+      return *this; }
+#endif
+    for (int i{}; i < 3; ++i) data[i] += V.data[i];
     return *this; }
-  constexpr Vec3f& operator-=(const Vec3f &V) noexcept {
-    data[0] -= V.data[0];
-    data[1] -= V.data[1];
-    data[2] -= V.data[2];
+  constexpr Vec3& operator-=(const Vec3 &V) noexcept {
+#ifdef VECTORS_SSE
+    if constexpr (use_sse) {
+      Store(_mm_sub_ps(Load(), V.Load()));
+      return *this; }
+#endif
+    for (int i{}; i < 3; ++i) data[i] -= V.data[i];
     return *this; }
-  constexpr Vec3f& operator*=(double d) noexcept {
-    data[0] *= d;
-    data[1] *= d;
-    data[2] *= d;
+  constexpr Vec3& operator*=(T d) noexcept {
+#ifdef VECTORS_SSE
+    if constexpr (use_sse) {
+      Store(_mm_mul_ps(Load(), _mm_set1_ps(d)));
+      return *this; }
+#endif
+    for (int i{}; i < 3; ++i) data[i] *= d;
     return *this; }
-  constexpr Vec3f& operator/=(double d) noexcept {
-    data[0] /= d;
-    data[1] /= d;
-    data[2] /= d;
-    return *this; }  
-  friend constexpr Vec3f operator+(const Vec3f &v1, const Vec3f &v2) noexcept { 
-    Vec3f v3 = v1; v3 += v2; return v3; }
-  friend constexpr Vec3f operator-(const Vec3f &v1) {
+  constexpr Vec3& operator/=(T d) noexcept {
+    return (*this) *= 1 / d; }
+  friend constexpr Vec3 operator+(const Vec3 &v1, const Vec3 &v2) noexcept { 
+    Vec3 v3 = v1; v3 += v2; return v3; }
+  friend constexpr Vec3 operator-(const Vec3 &v1) {
     return v1 * -1; }
-  friend constexpr Vec3f operator-(const Vec3f &v1, const Vec3f &v2) noexcept {
-    return Vec3f{v1} -= v2; }
-  friend constexpr Vec3f operator*(const Vec3f &v1, double d) noexcept {
-    return {v1.data[0] * d, v1.data[1] * d, v1.data[2] * d}; }
-  friend constexpr Vec3f operator*(const Vec3f &v1, const Vec3f &v2) noexcept {
-    return {v1.data[0] * v2.data[0], v1.data[1] * v2.data[1], v1.data[2] * v2.data[2]}; }
-  friend constexpr Vec3f operator*(double d, const Vec3f &v1) noexcept {
+  friend constexpr Vec3 operator-(const Vec3 &v1, const Vec3 &v2) noexcept {
+    return Vec3{v1} -= v2; }
+  friend constexpr Vec3 operator*(const Vec3 &v1, T d) noexcept {
+    return Vec3{v1} *= d; }
+  friend constexpr Vec3 operator*(const Vec3 &v1, const Vec3 &v2) noexcept {
+    Vec3 v3 = v1;
+#ifdef VECTORS_SSE
+    if constexpr (use_sse) {
+      v3.Store(_mm_mul_ps(v1.Load(), v2.Load()));
+      return v3; }
+#endif
+    for (int i{}; i < 3; ++i) v3.data[i] *= v2.data[i];
+    return v3; }
+  friend constexpr Vec3 operator*(T d, const Vec3 &v1) noexcept {
     return v1 * d; }
+  friend constexpr Vec3 operator/(const Vec3 &v1, T d) noexcept {
+    return Vec3{v1} /= d; }
 
   // --------------
   // INPUT / OUTPUT
-  friend std::ostream& operator<<(std::ostream &ostr, const Vec3f &v) {
+  friend std::ostream& operator<<(std::ostream &ostr, const Vec3 &v) {
     ostr << "< " << v.data[0] << " , " << v.data[1] << " , " << v.data[2] << " >";
     return ostr; }
-  friend std::istream& operator>>(std::istream &istr, Vec3f &v) {
+  friend std::istream& operator>>(std::istream &istr, Vec3 &v) {
     char ch_a,ch_b,ch_c,ch_d;
     istr >> ch_a >> v.data[0] >> ch_b >> v.data[1] >> ch_c >> v.data[2] >> ch_d;
     assert (ch_a == '<');
@@ -137,11 +192,21 @@ private:
 
   friend class Matrix;
 
+#ifdef VECTORS_SSE
+  // Vec3f is loaded and stored as a whole SSE register
+  static constexpr bool use_sse{std::is_same_v<T, float>};
+  [[nodiscard]] __m128 Load() const noexcept { return _mm_load_ps(data); }
+  void Store(__m128 v) noexcept { _mm_store_ps(data, v); }
+#endif
+
   // REPRESENTATION
-  double data[3];
+  T data[4];
   
 };
 
+using Vec3f = Vec3<float>;
+using Vec3d = Vec3<double>;
+
 // ====================================================================
 // ====================================================================
 